@@ -0,0 +1,851 @@
+// $Id: bench.cpp,v 1.1 2026-10-17 09:12:40-07 - - $
+
+// bench -
+//    Benchmarks for the simulated file system.  Each benchmark
+//    prints one line of JSON to cout, so that runs can be kept and
+//    compared by a script:  the build variant, its name, the number
+//    of operations, the time and heap allocations per operation,
+//    the peak resident set size so far, and whatever else it
+//    measures, all as numbers.  For instance:
+//       {"variant":"slab","name":"ls_one","ops":100000,
+//        "ns_per_op":412.3,"allocs_per_op":0,"peak_rss_kb":332568,
+//        "slab_reserved_kb":235072}
+//    Built three times by `make bench':  ybench uses the slabs,
+//    ybench_heap is compiled with -DSLAB_DISABLED, and ybench_atomic
+//    with -DREFCOUNT_ATOMIC.  Some benchmarks also check what they
+//    measure, and a failed check is reported on cerr and makes the
+//    exit status 1.  With -c, only those run, on smaller trees, as
+//    `make test' does.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "file_sys.h"
+#include "journal.h"
+#include "output.h"
+#include "slab.h"
+
+// operator new, operator delete -
+//    Replaced to count every heap allocation the program makes.
+
+static atomic<size_t> allocations {0};
+
+void* operator new (size_t bytes) {
+   allocations.fetch_add (1, memory_order_relaxed);
+   void* result = malloc (bytes == 0 ? 1 : bytes);
+   if (result == nullptr) throw bad_alloc();
+   return result;
+}
+
+void operator delete (void* ptr) noexcept { free (ptr); }
+void operator delete (void* ptr, size_t) noexcept { free (ptr); }
+
+// peak_rss_kb -
+//    Peak resident set size of this process, in kilobytes.
+
+static long peak_rss_kb() {
+   struct rusage usage;
+   getrusage (RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+}
+
+// stamp -
+//    Time and allocation count when a benchmark started.
+
+struct stamp {
+   chrono::steady_clock::time_point time {chrono::steady_clock::now()};
+   size_t allocations {::allocations};
+};
+
+// rss_kb -
+//    Current resident set size, from /proc/self/statm.
+
+static long rss_kb() {
+   ifstream statm ("/proc/self/statm");
+   long pages = 0;
+   long resident = 0;
+   statm >> pages >> resident;
+   return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+// report -
+//    Prints the JSON line of a benchmark that started at start and
+//    did ops operations, with any extra measurements after the
+//    usual ones.
+
+#if defined (SLAB_DISABLED)
+static constexpr const char* VARIANT {"heap"};
+#elif defined (REFCOUNT_ATOMIC)
+static constexpr const char* VARIANT {"atomic"};
+#else
+static constexpr const char* VARIANT {"slab"};
+#endif
+
+using extras = initializer_list<pair<const char*, double>>;
+
+// expect -
+//    Complains on cerr, and fails the run, unless ok.
+
+static int exit_status {EXIT_SUCCESS};
+
+static void expect (bool ok, const string& name, const char* what) {
+   if (ok) return;
+   cerr << "bench: " << name << ": " << what << endl;
+   exit_status = EXIT_FAILURE;
+}
+
+static void report (const string& name, size_t ops,
+                    const stamp& start, extras more = {}) {
+   stamp stop;
+   double nanos = chrono::duration<double, nano> (
+                  stop.time - start.time).count();
+   double allocs = stop.allocations - start.allocations;
+   cout << "{\"variant\":\"" << VARIANT << "\",\"name\":\"" << name
+        << "\",\"ops\":" << ops << ",\"ns_per_op\":" << nanos / ops
+        << ",\"allocs_per_op\":" << allocs / ops
+        << ",\"peak_rss_kb\":" << peak_rss_kb()
+        << ",\"slab_reserved_kb\":"
+        << slab_arena::bytes_reserved() / 1024;
+   for (const auto& [key, value]: more) {
+      cout << ",\"" << key << "\":" << value;
+   }
+   cout << "}" << endl;
+}
+
+// bench_build_tree -
+//    Creates dirs directories under the root, each holding files
+//    empty plain files, and reports the cost per inode created.
+
+static void bench_build_tree (inode_state& state, size_t dirs,
+                              size_t files) {
+   stamp start;
+   base_file_ptr& root = state.get_root()->get_contents();
+   for (size_t dir_nr = 0; dir_nr < dirs; ++dir_nr) {
+      inode_ptr dir = root->mkdir ("d" + to_string (dir_nr));
+      base_file_ptr& contents = dir->get_contents();
+      for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+         contents->mkfile ("f" + to_string (file_nr));
+      }
+   }
+   report ("build_tree", dirs * (files + 1), start);
+}
+
+// bench_wide_lookup -
+//    Looks up every name in one directory of the given width.
+
+static void bench_wide_lookup (inode_state& state, size_t width) {
+   base_file_ptr& wide = state.get_root()->get_contents()
+                       ->mkdir ("wide")->get_contents();
+   for (size_t file_nr = 0; file_nr < width; ++file_nr) {
+      wide->mkfile ("f" + to_string (file_nr));
+   }
+   vector<string> names;
+   for (size_t file_nr = 0; file_nr < width; ++file_nr) {
+      names.push_back ("f" + to_string (file_nr * 7919 % width));
+   }
+   size_t found = 0;
+   stamp start;
+   for (const string& name: names) {
+      if (wide->get_dirents().find (name) != nullptr) ++found;
+   }
+   report ("wide_lookup", found, start);
+}
+
+// bench_resolve -
+//    Builds a chain of directories depth components deep, then
+//    resolves a path through each of several depths along it, with
+//    the dentry cache warm and with it emptied before every lookup.
+//    A cold lookup should cost O(depth), a warm one O(1).
+
+static void bench_resolve (inode_state& state, size_t depth,
+                           size_t lookups) {
+   inode_ptr dir = state.get_root()->get_contents()->mkdir ("deep");
+   for (size_t level = 0; level < depth; ++level) {
+      dir = dir->get_contents()->mkdir ("d");
+   }
+   string_view tail;
+   for (size_t level = 1; level <= depth; level *= 8) {
+      string path = "deep";
+      for (size_t name = 0; name < level; ++name) path += "/d";
+      path += "/file";
+      for (bool cold: {false, true}) {
+         size_t hits = state.dentry_hits();
+         stamp start;
+         for (size_t lookup = 0; lookup < lookups; ++lookup) {
+            if (cold) state.invalidate_dentries();
+            state.get_inode_ptr_from_path (path, tail);
+         }
+         double hit = state.dentry_hits() - hits;
+         report ((cold ? "resolve_cold_" : "resolve_warm_")
+                 + to_string (level), lookups, start,
+                 {{"depth", level}, {"dentry_hits", hit}});
+      }
+   }
+}
+
+// bench_resolve_miss -
+//    Resolves paths that do not exist, half failing in the middle
+//    of the walk and half on the last component.
+
+static void bench_resolve_miss (inode_state& state, size_t lookups) {
+   string_view tail;
+   size_t misses = 0;
+   stamp start;
+   for (size_t lookup = 0; lookup < lookups; ++lookup) {
+      auto dir = state.get_inode_ptr_from_path (
+                 lookup % 2 ? "deep/d/nothere/file" : "deep/d/nothere",
+                 tail);
+      if (not dir or dir.value()->get_contents()->view().find (tail)
+                     == nullptr) {
+         ++misses;
+      }
+   }
+   report ("resolve_miss", misses, start);
+}
+
+// bench_ls_one -
+//    Runs ls on single files in a wide directory, with cout thrown
+//    away.  Costs O(log n) and should make no allocations.
+
+static void bench_ls_one (inode_state& state, size_t width,
+                          size_t count) {
+   wordvec paths;
+   for (size_t line = 0; line < count; ++line) {
+      paths.push_back ("wide/f" + to_string (line % width));
+   }
+   vector<wordviews> lines;
+   for (const string& path: paths) lines.push_back ({"ls", path});
+   streambuf* saved = cout.rdbuf (nullptr);
+   stamp start;
+   for (const wordviews& line: lines) dispatch (state, line);
+   cout.rdbuf (saved);
+   cout.clear();
+   cout.width (0);
+   report ("ls_one", count, start);
+}
+
+// bench_ls_wide -
+//    Lists the wide directory repeats times through an output_sink
+//    writing to /dev/null, as yshell does, and reports the cost per
+//    line printed.
+
+static void bench_ls_wide (inode_state& state, size_t repeats) {
+   int null_fd = open ("/dev/null", O_WRONLY);
+   if (null_fd < 0) { cerr << "bench: /dev/null" << endl; return; }
+   wordviews line {"ls", "wide"};
+   size_t width = state.get_root()->get_contents()->view()
+                  .find ("wide")->get_contents()->size();
+   {
+      output_sink sink (null_fd);
+      streambuf* saved = cout.rdbuf (&sink);
+      stamp start;
+      for (size_t repeat = 0; repeat < repeats; ++repeat) {
+         dispatch (state, line);
+      }
+      cout.flush();
+      cout.rdbuf (saved);
+      report ("ls_wide", repeats * (width + 1), start);
+   }
+   close (null_fd);
+}
+
+// bench_rm_wide -
+//    Tears the wide directory down:  removes every other file in it
+//    with rm, one command each, then the rest with rmr of the
+//    directory, and waits for the reclaimer to free them.
+
+static void bench_rm_wide (inode_state& state) {
+   size_t width = state.get_root()->get_contents()->view()
+                  .find ("wide")->get_contents()->totals().files;
+   vector<string> paths;
+   for (size_t file_nr = 0; file_nr < width; file_nr += 2) {
+      paths.push_back ("wide/f" + to_string (file_nr));
+   }
+   stamp start;
+   for (const string& path: paths) dispatch (state, {"rm", path});
+   report ("rm_wide", paths.size(), start);
+   size_t left = width - paths.size();
+   start = stamp();
+   dispatch (state, {"rmr", "wide"});
+   report ("rmr_wide", left, start);
+   start = stamp();
+   state.drain_reclaimer();
+   report ("reclaim_wide", left, start);
+}
+
+// bench_tokenize -
+//    Splits one make command line of the given number of words,
+//    reusing the tokenizer as main does.
+
+static void bench_tokenize (size_t words, size_t repeats) {
+   string line = "make file";
+   for (size_t word = 0; word < words; ++word) {
+      line += word % 8 ? " word" : "\tlonger_word_" + to_string (word);
+   }
+   tokenizer tokens;
+   size_t total = 0;
+   stamp start;
+   for (size_t repeat = 0; repeat < repeats; ++repeat) {
+      total += tokens.split (line, " \t").size();
+   }
+   report ("tokenize", total, start);
+}
+
+// bench_file_data -
+//    Makes files plain files of words words each, then reports the
+//    memory used per byte of file contents, and cat throughput.
+
+static void bench_file_data (inode_state& state, size_t files,
+                             size_t words) {
+   wordvec storage {"make", "file"};
+   for (size_t word = 0; word < words; ++word) {
+      storage.push_back ("w" + to_string (word));
+   }
+   wordviews line (storage.cbegin(), storage.cend());
+   size_t payload = 0;
+   for (size_t word = 2; word < line.size(); ++word) {
+      payload += line[word].size();
+   }
+   state.get_root()->get_contents()->mkdir ("data");
+   wordvec paths;
+   for (size_t file = 0; file < files; ++file) {
+      paths.push_back ("data/f" + to_string (file));
+   }
+   long rss_before = rss_kb();
+   stamp start;
+   for (const string& path: paths) {
+      line[1] = path;
+      dispatch (state, line);
+   }
+   double used = (rss_kb() - rss_before) * 1024.0;
+   report ("file_write", files, start,
+           {{"bytes_per_byte", used / (payload * files)}});
+   wordviews cat_line {"cat", "data/f0"};
+   streambuf* saved = cout.rdbuf (nullptr);
+   stamp cat_start;
+   for (size_t file = 0; file < files; ++file) {
+      dispatch (state, cat_line);
+   }
+   cout.rdbuf (saved);
+   cout.clear();
+   report ("file_cat", files, cat_start);
+}
+
+// bench_make_huge -
+//    Makes one file of words words repeats times over, as a make
+//    line of that many words would, and reports the cost per word.
+
+static void bench_make_huge (inode_state& state, size_t words,
+                             size_t repeats) {
+   wordvec storage {"make", "huge"};
+   for (size_t word = 0; word < words; ++word) {
+      storage.push_back ("word" + to_string (word % 1000));
+   }
+   wordviews line (storage.cbegin(), storage.cend());
+   stamp start;
+   for (size_t repeat = 0; repeat < repeats; ++repeat) {
+      dispatch (state, line);
+   }
+   report ("make_huge", words * repeats, start,
+           {{"words", words},
+            {"file_bytes", state.get_root()->get_contents()->view()
+                           .find ("huge")->get_contents()->size()}});
+   dispatch (state, {"rm", "huge"});
+}
+
+// walk_totals -
+//    Totals for a subtree computed the slow way, by visiting it.
+
+static subtree_totals walk_totals (const inode_ptr& node) {
+   auto& contents = node->get_contents();
+   if (not contents->is_directory()) return contents->totals();
+   subtree_totals result {0, 0, 1};
+   for (const auto& entry: contents->view()) {
+      result += walk_totals (entry.node);
+   }
+   return result;
+}
+
+// bench_du -
+//    Reads the totals of the root, which is O(1), and checks them
+//    against a full walk of the tree, failing if they differ.
+
+static void bench_du (inode_state& state, size_t count) {
+   int64_t bytes = 0;
+   stamp start;
+   for (size_t itor = 0; itor < count; ++itor) {
+      bytes += state.get_root()->get_contents()->totals().bytes;
+   }
+   report ("du_root", count, start,
+           {{"bytes", bytes / static_cast<int64_t> (count)}});
+   stamp walk_start;
+   subtree_totals walked = walk_totals (state.get_root());
+   subtree_totals kept = state.get_root()->get_contents()->totals();
+   bool consistent = walked.bytes == kept.bytes
+                 and walked.files == kept.files
+                 and walked.dirs == kept.dirs;
+   report ("du_walk", 1, walk_start, {{"consistent", consistent}});
+   expect (consistent, "du_walk", "kept totals differ from walk");
+}
+
+// bench_walk -
+//    Builds a directory under the root holding a chain of depth
+//    directories, each with width empty subdirectories besides the
+//    next link, then times lsr of it through an output_sink writing
+//    to /dev/null, and rmr of it, per directory visited.  rmr only
+//    unlinks the tree; reclaim_ is the time until the reclaimer
+//    thread has freed it.
+
+static void bench_walk (inode_state& state, const string& name,
+                        size_t depth, size_t width) {
+   int null_fd = open ("/dev/null", O_WRONLY);
+   if (null_fd < 0) { cerr << "bench: /dev/null" << endl; return; }
+   inode_ptr dir = state.get_root()->get_contents()->mkdir (name);
+   for (size_t level = 0; level < depth; ++level) {
+      base_file_ptr& contents = dir->get_contents();
+      for (size_t dir_nr = 0; dir_nr < width; ++dir_nr) {
+         contents->mkdir ("w" + to_string (dir_nr));
+      }
+      dir = contents->mkdir ("d");
+   }
+   dir = nullptr; // The reclaimer must hold the only references.
+   size_t nodes = depth * (width + 1) + 1;
+   {
+      output_sink sink (null_fd);
+      streambuf* saved = cout.rdbuf (&sink);
+      stamp start;
+      dispatch (state, {"lsr", name});
+      cout.flush();
+      cout.rdbuf (saved);
+      report ("lsr_" + name, nodes, start);
+   }
+   close (null_fd);
+   stamp start;
+   dispatch (state, {"rmr", name});
+   report ("rmr_" + name, nodes, start);
+   stamp reclaim_start;
+   state.drain_reclaimer();
+   report ("reclaim_" + name, nodes, reclaim_start);
+}
+
+// bench_lsr_threads -
+//    Builds a tree of fanout^levels directories with files plain
+//    files in each, then lists it with lsr -j for 1 to 64 threads
+//    through an output_sink writing to /dev/null, and reports the
+//    cost per directory listed.  Then times rmr of the whole tree,
+//    which should not depend on its size, and its reclamation.
+
+static void bench_lsr_threads (inode_state& state, size_t fanout,
+                               size_t levels, size_t files) {
+   int null_fd = open ("/dev/null", O_WRONLY);
+   if (null_fd < 0) { cerr << "bench: /dev/null" << endl; return; }
+   inode_ptr top = state.get_root()->get_contents()->mkdir ("forest");
+   vector<inode_ptr> level {top};
+   for (size_t depth = 0; depth < levels; ++depth) {
+      vector<inode_ptr> next;
+      for (const inode_ptr& dir: level) {
+         base_file_ptr& contents = dir->get_contents();
+         for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+            contents->mkfile ("f" + to_string (file_nr));
+         }
+         for (size_t dir_nr = 0; dir_nr < fanout; ++dir_nr) {
+            next.push_back (contents->mkdir ("d" + to_string (dir_nr)));
+         }
+      }
+      level = move (next);
+   }
+   level.clear();
+   size_t dirs = top->get_contents()->totals().dirs;
+   for (size_t threads: {1, 2, 4, 8, 16, 32, 64}) {
+      output_sink sink (null_fd);
+      streambuf* saved = cout.rdbuf (&sink);
+      string arg = to_string (threads);
+      stamp start;
+      dispatch (state, {"lsr", "-j", arg, "forest"});
+      cout.flush();
+      cout.rdbuf (saved);
+      report ("lsr_j" + arg, dirs, start);
+   }
+   close (null_fd);
+   size_t nodes = dirs + top->get_contents()->totals().files;
+   top = nullptr;
+   stamp start;
+   dispatch (state, {"rmr", "forest"});
+   report ("rmr_forest", 1, start);
+   stamp reclaim_start;
+   state.drain_reclaimer();
+   report ("reclaim_forest", nodes, reclaim_start);
+}
+
+// bench_churn -
+//    A long session in miniature:  makes and removes directories and
+//    files over and over, with rm and rmr, then checks that all the
+//    memory came back.  leaked_bytes counts slab bytes still in use,
+//    which must be 0, and rss_growth_kb the change in resident size.
+//    inode_nr_growth is how far inode numbers went past those given
+//    out after a first cycle, untimed, has made the free list as
+//    long as a cycle needs.  It must be 0 too, since numbers are
+//    reused.  Either one not 0 fails the run.  The reclaimer is
+//    drained after each rmr, so that the numbers it frees are back
+//    before the next cycle asks for more.
+
+static void bench_churn (inode_state& state, size_t cycles) {
+   auto cycle = [&state] {
+      dispatch (state, {"mkdir", "churn/a"});
+      dispatch (state, {"mkdir", "churn/a/b"});
+      dispatch (state, {"make", "churn/a/b/f", "some", "words"});
+      dispatch (state, {"mkdir", "churn/e"});
+      dispatch (state, {"make", "churn/g", "more", "words"});
+      dispatch (state, {"rm", "churn/e"});
+      dispatch (state, {"rm", "churn/g"});
+      dispatch (state, {"rmr", "churn/a"});
+      state.drain_reclaimer();
+   };
+   dispatch (state, {"mkdir", "churn"});
+   cycle();
+   size_t in_use = slab_arena::bytes_in_use();
+   long rss = rss_kb();
+   size_t numbers = inode_table::end();
+   stamp start;
+   for (size_t count = 0; count < cycles; ++count) cycle();
+   double leaked = slab_arena::bytes_in_use() - in_use;
+   double more_numbers = inode_table::end() - numbers;
+   report ("churn", cycles * 8, start,
+           {{"leaked_bytes", leaked},
+            {"rss_growth_kb", rss_kb() - rss},
+            {"inode_nr_growth", more_numbers}});
+   expect (leaked == 0, "churn", "slab bytes leaked");
+   expect (more_numbers == 0, "churn", "inode numbers not reused");
+   dispatch (state, {"rmr", "churn"});
+}
+
+// bench_find_inode -
+//    Finds inodes by number, as stat -i and ls -i do, cycling over
+//    every number given out so far, with the tree the benchmarks
+//    before have left.
+
+static void bench_find_inode (inode_state& state, size_t lookups) {
+   size_t end = inode_table::end();
+   size_t found = 0;
+   stamp start;
+   for (size_t lookup = 0; lookup < lookups; ++lookup) {
+      found += state.find_inode (1 + lookup % (end - 1)) != nullptr;
+   }
+   report ("find_inode", lookups, start,
+           {{"inode_nr_max", end - 1.0}, {"found", double (found)}});
+}
+
+// heap_bytes -
+//    Bytes of live data on the heap:  what malloc has handed out,
+//    less the slabs, plus what is in use in the slabs.
+
+static size_t heap_bytes() {
+   return mallinfo2().uordblks - slab_arena::bytes_reserved()
+        + slab_arena::bytes_in_use();
+}
+
+// bench_mv -
+//    Builds a directory under the root holding a chain of depth
+//    directories with files plain files at the bottom, then moves
+//    it back and forth between two names times over, to show that
+//    a move costs the same whatever is under it.  node_bytes is the
+//    heap each node of the tree took, which no longer grows with
+//    its depth, since a node holds only its own name.
+
+static void bench_mv (inode_state& state, size_t depth, size_t files,
+                      size_t times) {
+   string name = "mv" + to_string (depth) + "x" + to_string (files);
+   size_t heap = heap_bytes();
+   inode_ptr dir = state.get_root()->get_contents()->mkdir (name);
+   for (size_t level = 0; level < depth; ++level) {
+      dir = dir->get_contents()->mkdir ("d");
+   }
+   base_file_ptr& bottom = dir->get_contents();
+   for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+      bottom->mkfile ("f" + to_string (file_nr));
+   }
+   dir = nullptr;
+   size_t nodes = depth + files + 1;
+   double node_bytes = double (heap_bytes() - heap) / nodes;
+   string other = name + "_";
+   stamp start;
+   for (size_t time = 0; time < times; time += 2) {
+      dispatch (state, {"mv", name, other});
+      dispatch (state, {"mv", other, name});
+   }
+   report (name, times, start,
+           {{"nodes", double (nodes)}, {"node_bytes", node_bytes}});
+   dispatch (state, {"rmr", name});
+   state.drain_reclaimer();
+}
+
+// bench_snapshot -
+//    In a state of its own, builds dirs directories of files plain
+//    files each, then times snapshots with no change between them,
+//    and snapshots each followed by one make, which copies the path
+//    down to the file.  bytes_per_snapshot is the memory each of the
+//    latter keeps, to be compared with tree_bytes for the whole
+//    tree.  Last, times restore, which relinks the whole tree.
+
+static void bench_snapshot (size_t dirs, size_t files, size_t count) {
+   auto state = make_unique<inode_state>();
+   size_t before = heap_bytes();
+   for (size_t dir_nr = 0; dir_nr < dirs; ++dir_nr) {
+      string dir = "d" + to_string (dir_nr);
+      dispatch (*state, {"mkdir", dir});
+      for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+         string file = dir + "/f" + to_string (file_nr);
+         dispatch (*state, {"make", file, "some", "words"});
+      }
+   }
+   size_t tree_bytes = heap_bytes() - before;
+   stamp start;
+   for (size_t snap = 0; snap < count; ++snap) {
+      dispatch (*state, {"snapshot", "idle"});
+   }
+   report ("snapshot", count, start);
+   vector<string> names;
+   vector<string> paths;
+   for (size_t snap = 0; snap < count; ++snap) {
+      names.push_back ("s" + to_string (snap));
+      paths.push_back ("d" + to_string (snap * 7919 % dirs) + "/f"
+                       + to_string (snap * 104729 % files));
+   }
+   before = heap_bytes();
+   start = stamp();
+   for (size_t snap = 0; snap < count; ++snap) {
+      dispatch (*state, {"snapshot", names[snap]});
+      dispatch (*state, {"make", paths[snap], "changed"});
+   }
+   double kept = heap_bytes() - before;
+   report ("snapshot_make", count, start,
+           {{"bytes_per_snapshot", kept / count},
+            {"tree_bytes", tree_bytes}});
+   start = stamp();
+   dispatch (*state, {"restore", "s0"});
+   report ("restore", (files + 1) * dirs, start);
+}
+
+// bench_image -
+//    Builds dirs directories of files plain files each in a state
+//    of its own, and times saving it as an image, loading the image
+//    into another state, which should not depend on its size, and
+//    listing the whole tree loaded, which makes every node.
+
+static void bench_image (size_t dirs, size_t files) {
+   string filename = "/tmp/ybench." + to_string (getpid()) + ".img";
+   size_t nodes = dirs * (files + 1) + 1;
+   {
+      auto state = make_unique<inode_state>();
+      for (size_t dir_nr = 0; dir_nr < dirs; ++dir_nr) {
+         string dir = "d" + to_string (dir_nr);
+         dispatch (*state, {"mkdir", dir});
+         for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+            string file = dir + "/f" + to_string (file_nr);
+            dispatch (*state, {"make", file, "some", "words"});
+         }
+      }
+      stamp start;
+      dispatch (*state, {"save", filename});
+      report ("image_save", nodes, start);
+   }
+   auto state = make_unique<inode_state>();
+   stamp start;
+   state->load_image (filename);
+   report ("image_load", 1, start);
+   int null_fd = open ("/dev/null", O_WRONLY);
+   if (null_fd < 0) { cerr << "bench: /dev/null" << endl; return; }
+   {
+      output_sink sink (null_fd);
+      streambuf* saved = cout.rdbuf (&sink);
+      start = stamp();
+      dispatch (*state, {"lsr", "/"});
+      cout.flush();
+      cout.rdbuf (saved);
+      report ("image_lsr", nodes, start);
+   }
+   close (null_fd);
+   remove (filename.c_str());
+}
+
+// bench_journal -
+//    Logs records make commands to a journal in /tmp, once for each
+//    group commit batch size, then times replaying the journal into
+//    a state of its own.
+
+static void bench_journal (size_t records) {
+   string filename = "/tmp/ybench." + to_string (getpid()) + ".log";
+   vector<string> paths;
+   for (size_t record = 0; record < records; ++record) {
+      paths.push_back ("f" + to_string (record));
+   }
+   for (size_t batch: {1, 8, 64, 512}) {
+      remove (filename.c_str());
+      journal log (filename, batch);
+      stamp start;
+      for (size_t record = 0; record < records; ++record) {
+         log.append (record + 1,
+                     {"make", paths[record], "some", "words"});
+      }
+      log.sync();
+      report ("journal_batch_" + to_string (batch), records, start);
+   }
+   auto state = make_unique<inode_state>();
+   journal log (filename, journal::DEFAULT_BATCH);
+   stamp start;
+   size_t replayed = replay_journal (*state, log);
+   report ("journal_replay", replayed, start);
+   remove (filename.c_str());
+}
+
+// bench_dispatch -
+//    Looks up the command of each line of a mix, the old way, in an
+//    unordered_map keyed by string, and in the registry, and then
+//    times whole lines through dispatch with a command that does
+//    nothing, to show what is left per line.
+
+static void bench_dispatch (inode_state& state, size_t lines) {
+   static const string_view mix[] {
+      "ls", "cd", "make", "cat", "lsr", "mkdir", "pwd", "rm", "echo",
+      "du", "rmr", "snapshot", "#", "prompt",
+   };
+   unordered_map<string,command_fn> legacy;
+   for (string_view name: mix) {
+      legacy.emplace (name, find_command (name)->fn);
+   }
+   size_t found = 0;
+   stamp start;
+   for (size_t line = 0; line < lines; ++line) {
+      string_view name = mix[line % size (mix)];
+      found += legacy.find (string (name)) != legacy.end();
+   }
+   report ("dispatch_legacy", lines, start);
+   start = stamp();
+   for (size_t line = 0; line < lines; ++line) {
+      found += find_command (mix[line % size (mix)]) != nullptr;
+   }
+   report ("dispatch_registry", lines, start);
+   wordviews comment {"#", "a", "comment"};
+   start = stamp();
+   for (size_t line = 0; line < lines; ++line) {
+      dispatch (state, comment);
+   }
+   report ("dispatch_line", lines, start);
+   if (found != 2 * lines) cerr << "bench: lookups failed" << endl;
+}
+
+// bench_trace -
+//    Times a DEBUGF whose flag is off, one whose flag is on, which
+//    records an event into the ring of the thread and writes it to a
+//    trace file in /tmp, and the old way of tracing, a header and
+//    the payload through iostreams with endl, into /dev/null.
+
+static void bench_trace (size_t events) {
+   string filename = "/tmp/ybench." + to_string (getpid())
+                   + ".trace";
+   trace::start (filename);
+   debugflags::setflags ("T");
+   size_t value = 0;
+   stamp start;
+   for (size_t event = 0; event < events; ++event) {
+      DEBUGF ('U', "value = " << value);
+      ++value;
+   }
+   report ("trace_off", events, start);
+   start = stamp();
+   for (size_t event = 0; event < events; ++event) {
+      DEBUGF ('T', "value = " << value);
+      ++value;
+   }
+   report ("trace_on", events, start);
+   ofstream devnull ("/dev/null");
+   start = stamp();
+   for (size_t event = 0; event < events; ++event) {
+      devnull << "DEBUG(T) " << __FILE__ << "[" << __LINE__ << "] "
+              << endl << "... " << __PRETTY_FUNCTION__ << endl;
+      devnull << "value = " << value << endl;
+      ++value;
+   }
+   report ("trace_iostream", events, start);
+   remove (filename.c_str());
+}
+
+// bench_exit -
+//    Builds a tree of the given number of plain files in another
+//    inode_state, and times the exit command on it and the end of
+//    the state, which should not depend on its size.
+
+static void bench_exit (size_t files) {
+   stamp start;
+   {
+      auto state = make_unique<inode_state>();
+      base_file_ptr& root = state->get_root()->get_contents();
+      for (size_t file_nr = 0; file_nr < files; ++file_nr) {
+         if (file_nr % 1000 == 0) {
+            root->mkdir ("d" + to_string (file_nr / 1000));
+         }
+         root->view().find ("d" + to_string (file_nr / 1000))
+             ->get_contents()->mkfile ("f" + to_string (file_nr));
+      }
+      report ("exit_build", files, start);
+      start = stamp();
+      try {
+         dispatch (*state, {"exit"});
+      }catch (ysh_exit&) {
+      }
+      state = nullptr;
+   }
+   report ("exit", 1, start);
+}
+
+int main (int argc, char** argv) {
+   inode_state state;
+   if (argc > 1 and argv[1] == string ("-c")) {
+      bench_build_tree (state, 100, 100);
+      bench_file_data (state, 1000, 100);
+      bench_du (state, 1000);
+      bench_churn (state, 100000);
+      return exit_status;
+   }
+   bench_tokenize (200000, 20);
+   bench_build_tree (state, 1000, 1000);
+   bench_wide_lookup (state, 500000);
+   bench_ls_one (state, 500000, 100000);
+   bench_ls_wide (state, 10);
+   bench_rm_wide (state);
+   bench_resolve (state, 512, 100000);
+   bench_resolve_miss (state, 1000000);
+   bench_file_data (state, 10000, 1000);
+   bench_make_huge (state, 1000000, 10);
+   bench_du (state, 1000000);
+   bench_walk (state, "tall", 5000, 0);
+   bench_walk (state, "flat", 1, 200000);
+   bench_walk (state, "bushy", 1000, 100);
+   bench_lsr_threads (state, 20, 4, 4);
+   bench_mv (state, 1, 1, 1000000);
+   bench_mv (state, 500, 100000, 1000000);
+   bench_churn (state, 1000000);
+   bench_find_inode (state, 10000000);
+   bench_snapshot (100, 1000, 10000);
+   bench_image (1000, 1000);
+   bench_journal (20000);
+   bench_dispatch (state, 10000000);
+   bench_trace (1000000);
+   bench_exit (1000000);
+   return exit_status;
+}
+
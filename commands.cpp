@@ -1,36 +1,363 @@
 // $Id: commands.cpp,v 1.19 2020-10-20 18:23:13-07 - - $
 
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
 #include "commands.h"
 #include "debug.h"
-#include <iomanip>      // std::setw
-
-command_hash cmd_hash {
-   {"cat"   , fn_cat   },
-   {"cd"    , fn_cd    },
-   {"echo"  , fn_echo  },
-   {"exit"  , fn_exit  },
-   {"ls"    , fn_ls    },
-   {"lsr"   , fn_lsr   },
-   {"make"  , fn_make  },
-   {"mkdir" , fn_mkdir },
-   {"prompt", fn_prompt},
-   {"pwd"   , fn_pwd   },
-   {"rm"    , fn_rm    },
-   {"rmr"   , fn_rmr   },
-   {"#"     , fn_ignore},
-   {"^D"    , fn_exit},
+#include "metrics.h"
+#include "output.h"
+
+// commands -
+//    The registry.  Its order does not matter:  the perfect hash
+//    table below is built from it at compile time.
+
+static constexpr size_t ANY {command::UNLIMITED};
+static constexpr path_operands NO_PATHS {path_operands::NONE};
+static constexpr path_operands FIRST_PATH {path_operands::FIRST};
+static constexpr path_operands ALL_PATHS {path_operands::ALL};
+
+static constexpr command commands[] {
+   {"cat",       fn_cat,       0, ANY, "",   ALL_PATHS,  false, false,
+                 "cat [PATH...]", ""},
+   {"cd",        fn_cd,        0, 1,   "",   ALL_PATHS,  false, true,
+                 "cd [DIR]", ""},
+   {"du",        fn_du,        0, ANY, "s",  ALL_PATHS,  false, false,
+                 "du [-s] [PATH...]", ""},
+   {"echo",      fn_echo,      0, ANY, "",   NO_PATHS,   false, false,
+                 "echo [WORD...]", ""},
+   {"exit",      fn_exit,      0, 1,   "",   NO_PATHS,   false, false,
+                 "exit [STATUS]", ""},
+   {"ls",        fn_ls,        0, ANY, "i",  ALL_PATHS,  false, false,
+                 "ls [PATH...] | ls -i INODE...", ""},
+   {"lsr",       fn_lsr,       0, ANY, "j:", ALL_PATHS,  false, false,
+                 "lsr [-j THREADS] [PATH...]", ""},
+   {"make",      fn_make,      1, ANY, "",   FIRST_PATH, true,  true,
+                 "make FILE [WORD...]",
+                 "Please specify file name. No directories."},
+   {"mkdir",     fn_mkdir,     1, 1,   "",   FIRST_PATH, true,  true,
+                 "mkdir DIR", "Enter a dir name."},
+   {"mv",        fn_mv,        2, 2,   "",   ALL_PATHS,  true,  true,
+                 "mv PATH DEST", ""},
+   {"prompt",    fn_prompt,    0, ANY, "",   NO_PATHS,   false, false,
+                 "prompt [WORD...]", ""},
+   {"pwd",       fn_pwd,       0, 0,   "",   NO_PATHS,   false, false,
+                 "pwd", ""},
+   {"rm",        fn_rm,        1, 1,   "",   FIRST_PATH, true,  true,
+                 "rm PATH",
+                 "Cannot delete parent directory or non-existing"
+                 " file."},
+   {"rmr",       fn_rmr,       1, 1,   "",   FIRST_PATH, true,  true,
+                 "rmr PATH",
+                 "Cannot delete parent directory on non-existing dir."},
+   {"restore",   fn_restore,   1, 1,   "",   NO_PATHS,   true,  true,
+                 "restore NAME", ""},
+   {"save",      fn_save,      1, 1,   "",   NO_PATHS,   false, false,
+                 "save IMAGE", ""},
+   {"snapshot",  fn_snapshot,  1, 1,   "",   NO_PATHS,   true,  true,
+                 "snapshot NAME", ""},
+   {"snapshots", fn_snapshots, 0, 0,   "",   NO_PATHS,   false, false,
+                 "snapshots", ""},
+   {"stat",      fn_stat,      1, ANY, "i",  ALL_PATHS,  false, false,
+                 "stat PATH... | stat -i INODE...", ""},
+   {"stats",     fn_stats,     0, 1,   "",   NO_PATHS,   false, false,
+                 "stats [reset]", ""},
+   {"#",         fn_ignore,    0, ANY, "",   NO_PATHS,   false, false,
+                 "# [WORD...]", ""},
+   {"^D",        fn_exit,      0, 0,   "",   NO_PATHS,   false, false,
+                 "^D", ""},
+};
+
+// command_table -
+//    A perfect hash table over the registry:  slots holds the index
+//    in commands of the one command, if any, whose name hashes to
+//    that slot with seed.  build_command_table tries seeds until
+//    no two names collide, which for a few dozen names in 64 slots
+//    takes a handful of tries, all done by the compiler.
+
+static constexpr size_t COMMAND_SLOTS {64};
+static constexpr uint8_t NO_COMMAND {0xFF};
+
+static_assert (size (commands) < NO_COMMAND);
+
+struct command_table {
+   uint32_t seed {0};
+   uint8_t slots[COMMAND_SLOTS] {};
 };
 
-command_fn find_command_fn (const string& cmd) {
-   // Note: value_type is pair<const key_type, mapped_type>
-   // So: iterator->first is key_type (string)
-   // So: iterator->second is mapped_type (command_fn)
-   DEBUGF ('c', "[" << cmd << "]");
-   const auto result = cmd_hash.find (cmd);
-   if (result == cmd_hash.end()) {
-      throw command_error (cmd + ": no such function");
+static constexpr size_t command_hash (string_view name,
+                                      uint32_t seed) {
+   uint32_t hash = 2166136261u ^ seed;
+   for (char byte: name) {
+      hash = (hash ^ static_cast<unsigned char> (byte)) * 16777619u;
+   }
+   return (hash ^ hash >> 16) % COMMAND_SLOTS;
+}
+
+static constexpr command_table build_command_table() {
+   command_table table;
+   for (;; ++table.seed) {
+      for (uint8_t& slot: table.slots) slot = NO_COMMAND;
+      size_t placed = 0;
+      for (; placed < size (commands); ++placed) {
+         uint8_t& slot = table.slots[command_hash (
+                         commands[placed].name, table.seed)];
+         if (slot != NO_COMMAND) break;
+         slot = placed;
+      }
+      if (placed == size (commands)) return table;
+   }
+}
+
+static constexpr command_table command_slots {build_command_table()};
+
+const command* find_command (string_view name) {
+   uint8_t slot = command_slots.slots[command_hash (
+                  name, command_slots.seed)];
+   if (slot == NO_COMMAND or commands[slot].name != name) {
+      return nullptr;
+   }
+   return &commands[slot];
+}
+
+// command_stats -
+//    The metrics of each command, by its index in the registry, and
+//    last those of lines naming no command.
+// stats_base -
+//    The file system counters when stats were last reset, so that
+//    stats can show what has been counted since.
+
+static constexpr size_t UNKNOWN_COMMAND {size (commands)};
+static command_metrics command_stats[size (commands) + 1];
+static fs_counters stats_base;
+
+// option_end -
+//    If words[index] is one of the options of cmd, the index of the
+//    word after it and its value, if it takes one, else 0.  Throws
+//    command_error if its value is missing.
+
+static size_t option_end (const command& cmd, const wordviews& words,
+                          size_t index) {
+   string_view word = words.at (index);
+   if (word.size() != 2 or word[0] != '-') return 0;
+   size_t letter = cmd.options.find (word[1]);
+   if (letter == string_view::npos or word[1] == ':') return 0;
+   if (letter + 1 == cmd.options.size()
+       or cmd.options[letter + 1] != ':') return index + 1;
+   if (index + 1 == words.size()) {
+      throw command_error (string (cmd.name) + ": usage: "
+                           + string (cmd.usage));
+   }
+   return index + 2;
+}
+
+bool command_args::option (char letter) const {
+   for (size_t index = 1; index < first;
+        index = option_end (cmd, words, index)) {
+      if (words[index][1] == letter) return true;
+   }
+   return false;
+}
+
+string_view command_args::option_value (char letter) const {
+   for (size_t index = 1; index < first;
+        index = option_end (cmd, words, index)) {
+      if (words[index][1] == letter) return words[index + 1];
+   }
+   return "";
+}
+
+// log_command -
+//    Logs a command to the journal, if there is one, before it is
+//    run, so that it is never run without being logged.
+
+static void log_command (inode_state& state, const wordviews& words) {
+   journal* log = state.get_journal();
+   if (log == nullptr) return;
+   try {
+      log->append (state.journal_seq() + 1, words);
+   }catch (runtime_error& error) {
+      throw command_error (string ("journal: ") + error.what());
+   }
+   state.journal_seq (state.journal_seq() + 1);
+}
+
+// compact_journal -
+//    Once the journal has grown past COMPACT_BYTES, saves the tree
+//    as an image next to it, and empties it, logging a cd to put the
+//    current directory back.  An image holds no snapshots, so this
+//    waits until there are none.  The journal is emptied only once
+//    save_image has returned, when the image is on disk, so that a
+//    crash never loses the records of both.
+
+static void compact_journal (inode_state& state) {
+   journal* log = state.get_journal();
+   if (log == nullptr or log->bytes() < journal::COMPACT_BYTES
+       or not state.get_snapshots().empty()) return;
+   DEBUGF ('j', log->filename() << ": compacting " << log->bytes()
+           << " bytes");
+   try {
+      state.save_image (journal_image (*log));
+      log->clear();
+      if (state.get_cwd() != state.get_root()) {
+         string cwd = state.get_cwd()->get_contents()->pathname();
+         log->append (state.journal_seq() + 1, {"cd", cwd});
+         state.journal_seq (state.journal_seq() + 1);
+      }
+   }catch (runtime_error& error) {
+      complain() << "journal: " << error.what() << endl;
+   }
+}
+
+string journal_image (const journal& log) {
+   return log.filename() + ".img";
+}
+
+size_t replay_journal (inode_state& state, journal& log) {
+   // Commands print nothing while they are replayed.
+   streambuf* out = cout.rdbuf (nullptr);
+   // Detached, so that replayed commands are not logged again.
+   journal* live = state.get_journal();
+   state.set_journal (nullptr);
+   size_t replayed = 0;
+   log.replay ([&] (uint64_t seq, const wordviews& words) {
+      if (seq <= state.journal_seq()) return;
+      state.journal_seq (seq);
+      ++replayed;
+      try {
+         dispatch (state, words);
+      }catch (command_error&) {
+      }catch (file_error&) {
+      }
+   });
+   state.set_journal (live);
+   cout.rdbuf (out);
+   return replayed;
+}
+
+// checked -
+//    The command found for a name, or else throws command_error.
+
+static const command& checked (const command* cmd, string_view name) {
+   DEBUGF ('c', "[" << name << "]");
+   if (cmd == nullptr) {
+      throw command_error (string (name) + ": no such function");
+   }
+   return *cmd;
+}
+
+// run -
+//    All of dispatch after the command is found.
+
+static void run (inode_state& state, const command& found,
+                 const wordviews& words) {
+   const command* cmd = &found;
+   size_t first = 1;
+   if (not cmd->options.empty()) {
+      while (first < words.size()) {
+         size_t next = option_end (*cmd, words, first);
+         if (next == 0) break;
+         first = next;
+      }
+   }
+   size_t operands = words.size() - first;
+   if (operands < cmd->min_args and not cmd->missing.empty()) {
+      cout << cmd->missing << '\n';
+      return;
+   }
+   if (operands < cmd->min_args or operands > cmd->max_args) {
+      throw command_error (string (cmd->name) + ": usage: "
+                           + string (cmd->usage));
+   }
+   if (cmd->journaled) log_command (state, words);
+   if (cmd->mutates) state.invalidate_dentries();
+   // Reused from line to line, and emptied after each, so that it
+   // holds no references into the tree between commands.
+   static vector<resolved_path> paths;
+   struct clear_paths {
+      ~clear_paths() { paths.clear(); }
+   } clear;
+   size_t last = cmd->paths == path_operands::ALL ? words.size()
+               : cmd->paths == path_operands::FIRST ? first + 1
+               : first;
+   for (size_t index = first; index < last; ++index) {
+      string_view name;
+      auto dir = state.get_inode_ptr_from_path (words[index], name);
+      paths.push_back ({words[index], name, move (dir)});
+   }
+   cmd->fn (state, {*cmd, words, first, paths});
+}
+
+void dispatch (inode_state& state, const wordviews& words) {
+   run (state, checked (find_command (words.at(0)), words.at(0)),
+        words);
+}
+
+void run_command (inode_state& state, const wordviews& words) {
+   if (words.empty()) return;
+   const command* cmd = find_command (words.at(0));
+   command_timer timer (command_stats[cmd == nullptr ? UNKNOWN_COMMAND
+                                      : cmd - commands]);
+   try {
+      run (state, checked (cmd, words.at(0)), words);
+      compact_journal (state);
+   }catch (command_error& error) {
+      // If there is a problem discovered in any function, an
+      // exn is thrown and printed here.
+      timer.failed();
+      complain() << error.what() << endl;
+   }catch (file_error& error) {
+      timer.failed();
+      complain() << error.what() << endl;
+   }
+   end_of_command (cout);
+}
+
+// stats_name -
+//    The name stats are shown under for a slot of command_stats.
+
+static string_view stats_name (size_t index) {
+   return index == UNKNOWN_COMMAND ? "(unknown)" : commands[index].name;
+}
+
+// stats_since -
+//    The file system counters since stats were last reset.  Those
+//    that are levels, not counts, are left as they are.
+
+static fs_counters stats_since (inode_state& state) {
+   fs_counters now = state.counters();
+   now.components_resolved -= stats_base.components_resolved;
+   now.dirent_copies -= stats_base.dirent_copies;
+   now.dentry_hits -= stats_base.dentry_hits;
+   now.dentry_misses -= stats_base.dentry_misses;
+   return now;
+}
+
+void print_stats_json (inode_state& state, ostream& out) {
+   out << "{\"commands\":{";
+   const char* comma = "";
+   for (size_t index = 0; index < size (command_stats); ++index) {
+      const command_metrics& stats = command_stats[index];
+      if (stats.calls == 0) continue;
+      out << comma << "\"" << stats_name (index) << "\":{\"calls\":"
+          << stats.calls << ",\"errors\":" << stats.errors
+          << ",\"p50_ns\":" << stats.latency.percentile (0.50)
+          << ",\"p99_ns\":" << stats.latency.percentile (0.99)
+          << ",\"p999_ns\":" << stats.latency.percentile (0.999)
+          << ",\"histogram\":";
+      stats.latency.print_json (out);
+      out << "}";
+      comma = ",";
    }
-   return result->second;
+   fs_counters counters = stats_since (state);
+   out << "},\"fs\":{\"inodes_live\":" << counters.inodes_live
+       << ",\"inode_nr_max\":" << counters.inode_nr_max
+       << ",\"bytes_stored\":" << counters.bytes_stored
+       << ",\"components_resolved\":" << counters.components_resolved
+       << ",\"dirent_copies\":" << counters.dirent_copies
+       << ",\"dentry_hits\":" << counters.dentry_hits
+       << ",\"dentry_misses\":" << counters.dentry_misses << "}}\n";
 }
 
 command_error::command_error (const string& what):
@@ -43,251 +370,436 @@ int exit_status_message() {
    return status;
 }
 
-void fn_cat (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   string filename = "";
+void fn_cat (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    string err = "No such plain file.";
-   for (size_t file_num = 1; file_num < words.size(); ++file_num){
-      if (words.size() < 2) { cout << err << endl; continue; }
-      err = "cat: " + words.at(1) + ": " + err;
-      try { 
-         auto dir = state.get_inode_ptr_from_path(
-            words.at(file_num), filename);
-         auto dirents = dir->get_contents()->get_dirents();
-         if (dirents.find(filename) == dirents.end()) {
-            throw file_error("Going to catch"); };
-         auto toCat = dir->get_contents()->get_dirents()[filename];
-         for ( auto i : toCat->get_contents()->readfile()) {
-            cout << i << " "; }
-         cout << endl;
-      }
-      catch(std::exception const& e) {
-         cout << err << endl; }
+   for (const resolved_path& path: args.paths){
+      err = "cat: " + string(args.paths.front().path) + ": " + err;
+      if (not path.dir) { cout << err << '\n'; continue; }
+      auto toCat = path.dir.value()->get_contents()->view()
+                   .find(path.name);
+      if (toCat == nullptr or toCat->get_contents()->is_directory())
+      {
+         cout << err << '\n'; continue; }
+      cout << toCat->get_contents()->readfile().text() << '\n';
    }
 }
 
-void fn_cd (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+void fn_cd (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    auto err = "Please specify directory name. No plain files.";
-   string dirname = "";
-   if (words.size() < 2) { state.set_cwd(state.get_root()); return; }
-   try {
-      auto dir = state.get_inode_ptr_from_path(words.at(1), dirname);
-      auto dirents = dir->get_contents()->get_dirents();
-      if (dirname == "/") { state.set_cwd(state.get_root()); return; }
-      if (dirents.find(dirname) == dirents.end()) {
-         throw file_error("Going to catch"); };
-      auto toCd = dirents[dirname];
-      toCd->get_contents()->get_dirents(); // Verify its a dir
-      state.set_cwd(toCd);
+   if (args.paths.empty()) { state.set_cwd(state.get_root()); return; }
+   const resolved_path& path = args.paths.front();
+   if (not path.dir) { cout << err << '\n'; return; }
+   if (path.name == "/") { state.set_cwd(state.get_root()); return; }
+   auto toCd = path.dir.value()->get_contents()->view()
+               .find(path.name);
+   if (toCd == nullptr or not toCd->get_contents()->is_directory()) {
+      cout << err << '\n'; return; }
+   state.set_cwd(inode_ptr (toCd));
+}
+
+// numbered_inode -
+//    The inode whose number is the word given, or nullptr if there
+//    is none, or the word is not a number.
+
+static inode* numbered_inode (inode_state& state, string_view word) {
+   size_t nr = 0;
+   const char* last = word.data() + word.size();
+   auto [end, error] = from_chars (word.data(), last, nr);
+   if (error != errc() or end != last) return nullptr;
+   return state.find_inode (nr);
+}
+
+// print_du -
+//    One line of du:  bytes, plain files, and directories, then the
+//    pathname.  Unless summary is set, every directory below is
+//    printed first, in depth-first postorder, as du(1) does.
+
+static void print_du_line (base_file& contents) {
+   auto totals = contents.totals();
+   put_right (cout, totals.bytes, 8); cout << "  ";
+   put_right (cout, totals.files, 6); cout << "  ";
+   put_right (cout, totals.dirs, 6);
+   cout << "  " << contents.pathname() << '\n';
+}
+
+static void print_du (inode* node, bool summary) {
+   auto& contents = node->get_contents();
+   if (summary or not contents->is_directory()) {
+      print_du_line (*contents);
+      return;
+   }
+   walk_tree (*contents, walk_order::POSTORDER, print_du_line);
+}
+
+void fn_du (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   bool summary = args.option('s');
+   if (args.paths.empty()) { 
+      print_du (state.get_cwd().get(), summary); return; }
+   for (const resolved_path& path: args.paths){
+      if (path.dir and path.name == "/") { 
+         print_du (state.get_root().get(), summary); continue; }
+      auto toDu = path.dir ? path.dir.value()->get_contents()->view()
+                             .find(path.name) : nullptr;
+      if (toDu == nullptr) { 
+         cout << "du: " << path.path 
+              << ": No such file or directory." << '\n'; 
+         continue; }
+      print_du (toDu, summary);
    }
-   catch(std::exception const& e) {
-      cout << err << endl; return; }
 }
 
-void fn_echo (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   cout << word_range (words.cbegin() + 1, words.cend()) << endl;
+void fn_echo (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   cout << make_pair (args.words.cbegin() + 1, args.words.cend())
+        << '\n';
 }
 
-
-void fn_exit (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+
+void fn_exit (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    int val = 0;
-   if (words.size() > 1) {
+   if (args.operands() > 0) {
       try {
-         val = std::stoi(words.at(1));
+         val = std::stoi(string(args.words.at(args.first)));
       } 
       catch(std::exception const& e) {
          val = 127;
       }
    }
    exec::status(val);
-
-   state.get_cwd() = state.get_root();  // Let's recursively clear state
-   state.get_root()->get_contents()->recur_rmr();
-   state.get_root()->get_contents()->get_dirents().erase(".");
-   state.get_root()->get_contents()->get_dirents().erase("..");
-   state.get_root()->get_contents() = nullptr;
-   state.get_root() = nullptr;
+   // No teardown:  the state leaks the tree as the program exits.
    throw ysh_exit();
 }
 
-void fn_ls (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   if (words.size() < 2) { 
-      state.get_cwd()->get_contents()->print_dirents(); return; }
-   for (size_t path_num = 1; path_num < words.size(); ++path_num){
-      // auto err = "Please specify directory name. No plain files.";
-      auto dir = state.get_cwd();
-      string dirname = "";
-      try {
-         dir = state.get_inode_ptr_from_path(
-            words.at(path_num), dirname);
-         auto dirents = dir->get_contents()->get_dirents();
-         if (dirname == "/") {
-            state.get_root()->get_contents()->print_dirents(); 
-            continue; 
-            }
-         if (dirents.find(dirname) == dirents.end()) {
-            throw file_error("Going to catch"); };
-         auto toLs = dirents[dirname];
-         toLs->get_contents()->get_dirents(); // Verify its a dir
-         toLs->get_contents()->print_dirents();
+// print_ls -
+//    What ls prints for one operand:  the listing of a directory, or
+//    the inode number, size, and name of a plain file.
+
+static void print_ls (inode* node, string_view name) {
+   auto& contents = node->get_contents();
+   if (contents->is_directory()) {
+      contents->print_dirents(cout);
+      return;
+   }
+   put_right (cout, node->get_inode_nr(), 6);
+   put_right (cout, contents->size(), 8);
+   cout << "  " << name << '\n';
+}
+
+void fn_ls (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   if (args.option('i')) {
+      for (size_t index = args.first; index < args.words.size();
+           ++index) {
+         inode* node = numbered_inode (state, args.words[index]);
+         if (node == nullptr) {
+            cout << "File does not exist." << '\n'; continue; }
+         print_ls (node, node->get_contents()->pathname());
       }
-      catch(std::exception const& e) {
-         if (dir->get_contents()->get_dirents().find(dirname) !=
-         dir->get_contents()->get_dirents().end() ) {
-            cout << setw(6) << dir->get_contents()->
-               get_dirents()[dirname]->get_inode_nr();
-            cout << setw(8) << dir->get_contents()->
-               get_dirents()[dirname]->get_contents()->size() << "  ";
-            cout << dirname << endl; continue; 
-         }
-         else cout << "File does not exist." << endl;
+      return;
+   }
+   if (args.paths.empty()) { 
+      state.get_cwd()->get_contents()->print_dirents(cout); return; }
+   for (const resolved_path& path: args.paths){
+      string_view dirname = path.name;
+      if (path.dir and dirname == "/") {
+         state.get_root()->get_contents()->print_dirents(cout); 
+         continue; 
       }
+      auto toLs = path.dir ? path.dir.value()->get_contents()->view()
+                             .find(dirname) : nullptr;
+      if (toLs == nullptr) {
+         cout << "File does not exist." << '\n'; continue; }
+      print_ls (toLs, dirname);
    }
 }
 
-void fn_lsr (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   if (words.size() < 2) { 
-      state.get_cwd()->get_contents()->recur_lsr(); 
+// lsr_threads -
+//    The operand of lsr -j:  the number of threads, 1 to 256.
+
+static size_t lsr_threads (string_view arg) {
+   static constexpr size_t MAX_THREADS {256};
+   size_t threads = 0;
+   auto [end, error] = from_chars (arg.data(), arg.data() + arg.size(),
+                                   threads);
+   if (error == errc() and end == arg.data() + arg.size()
+       and threads >= 1 and threads <= MAX_THREADS) return threads;
+   throw command_error ("lsr: -j: " + string (arg)
+                        + ": invalid number of threads");
+}
+
+void fn_lsr (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   size_t threads = 1;
+   if (args.option('j')) threads = lsr_threads (args.option_value('j'));
+   if (args.paths.empty()) { 
+      state.get_cwd()->get_contents()->recur_lsr(threads); 
       return; 
       }
-   for (size_t path_num = 1; path_num < words.size(); ++path_num){
+   for (const resolved_path& path: args.paths){
       auto err = "Please specify directory name. No plain files.";
-      auto dirToLsr = state.get_root();
-      auto dir = state.get_cwd();
-      if (words.size() > 1) {
-         string dirname = "";
-         try {  // Try to get dirents
-            dir = state.get_inode_ptr_from_path(
-               words.at(path_num), dirname);
-            auto dirents = dir->get_contents()->get_dirents();
-            if (dirname == "/") { dirname = "."; }
-            if (dirents.find(dirname) == dirents.end()) {
-               throw file_error("Going to catch"); };
-            dirToLsr = dirents[dirname];
-            dirToLsr->get_contents()->recur_lsr();
-         }
-         catch(std::exception const& e) {
-         if (dir->get_contents()->get_dirents().find(dirname) !=
-         dir->get_contents()->get_dirents().end() ) {
-            cout << setw(6) << dir->get_contents()
-               ->get_dirents()[dirname]->get_inode_nr() << "  ";
-            cout << setw(6) << dir->get_contents()
-               ->get_dirents()[dirname]->get_contents()->size() << "  ";
-            cout << dirname << endl; 
-            continue; 
-         }
-         else 
-            { cout << err << endl; continue; }
-         }
+      string_view dirname = path.name;
+      if (dirname == "/") { dirname = "."; }
+      auto dirToLsr = path.dir ? path.dir.value()->get_contents()
+                                 ->view().find(dirname) : nullptr;
+      if (dirToLsr == nullptr) { cout << err << '\n'; continue; }
+      if (dirToLsr->get_contents()->is_directory()) {
+         dirToLsr->get_contents()->recur_lsr(threads);
+         continue;
       }
-      else {
-         dirToLsr->get_contents()->recur_lsr();
-         }
+      put_right (cout, dirToLsr->get_inode_nr(), 6);
+      cout << "  ";
+      put_right (cout, dirToLsr->get_contents()->size(), 6);
+      cout << "  " << dirname << '\n';
    }
 }
 
-void fn_make (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+void fn_make (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    auto err = "Please specify file name. No directories.";
-   if (words.size() < 2) { cout << err << endl; return; }
-   try
-   {
-      string back_name = "";
-      auto toMake = state.get_inode_ptr_from_path(
-         words.at(1), back_name);
-      auto existing_file_dirents = toMake->get_contents()
-         ->get_dirents();
-      if(existing_file_dirents.find(back_name) == 
-         existing_file_dirents.end()) 
-      { 
-         toMake->get_contents()->mkfile(back_name)
-            ->get_contents()->writefile(words); }
-      else { existing_file_dirents[back_name]->get_contents()
-            ->writefile(words); }
-   }
-   catch(std::exception const& e) {
-      cout << err << endl;
-   }
-}
-
-void fn_mkdir (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   string back_name = "";
-   if (words.size() < 2) { 
-      cout << "Enter a dir name." << endl; 
-      return; 
+   const resolved_path& path = args.paths.front();
+   if (not path.dir) { cout << err << '\n'; return; }
+   auto existing = path.dir.value()->get_contents()->view()
+                   .find(path.name);
+   if (existing != nullptr 
+       and existing->get_contents()->is_directory()) {
+      cout << err << '\n'; return; }
+   inode* dir = state.writable(path.dir.value().get());
+   auto& file = existing == nullptr 
+      ? dir->get_contents()->mkfile(path.name)->get_contents()
+      : state.writable(dir, path.name)->get_contents();
+   auto before = file->totals();
+   file->writefile(args.words);
+   dir->get_contents()->add_totals(
+      {file->totals().bytes - before.bytes, 0, 0});
+}
+
+void fn_mkdir (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   const resolved_path& path = args.paths.front();
+   if (not path.dir) {
+      cout << "Directory path does not exist." << '\n'; return; }
+   if (path.dir.value()->get_contents()->view().find(path.name)
+       == nullptr) { 
+      state.writable(path.dir.value().get())->get_contents()
+           ->mkdir(path.name);
    }
-   try {
-      auto toMakeIn = state.get_inode_ptr_from_path(
-         words.at(1), back_name);
-      if (toMakeIn->get_contents()->get_dirents().find(back_name) 
-       == toMakeIn->get_contents()->get_dirents().end()) 
-      { 
-         toMakeIn->get_contents()->mkdir(back_name);
+   else { cout << "Directory already exists." << '\n'; };
+}
+
+// fn_mv -
+//    Only the two directories change:  the entry is unlinked from
+//    one and linked into the other, and nothing below it is touched,
+//    so a move costs the same whatever it moves.
+
+void fn_mv (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   const resolved_path& from = args.paths[0];
+   string_view name = from.name;
+   string source = "mv: " + string (from.path);
+   if (not from.dir) {
+      throw command_error (source + ": No such file or directory");
+   }
+   if (name == "." or name == ".." or name == "/") {
+      throw command_error (source + ": cannot move");
+   }
+   inode* from_dir = from.dir.value().get();
+   if (from_dir->get_contents()->view().find(name) == nullptr) {
+      throw command_error (source + ": No such file or directory");
+   }
+   from_dir = state.writable(from_dir);
+   inode_ptr node (from_dir->get_contents()->view().find(name));
+   // Copying the directories above the source may have copied those
+   // the destination was resolved through, so it is resolved again.
+   string target = "mv: " + string (args.paths[1].path);
+   string_view to_name;
+   auto to_dir = state.get_inode_ptr_from_path (args.paths[1].path,
+                                                to_name);
+   if (not to_dir) {
+      throw command_error (target + ": No such file or directory");
+   }
+   inode* into = to_name == "/" ? state.get_root().get()
+               : to_dir.value()->get_contents()->view().find(to_name);
+   if (into != nullptr) {
+      if (not into->get_contents()->is_directory()) {
+         throw command_error (target + ": File exists");
+      }
+      to_dir.value() = inode_ptr (into);
+      to_name = name;
+      if (into->get_contents()->view().find(to_name) != nullptr) {
+         throw command_error (target + "/" + string (to_name)
+                              + ": File exists");
       }
-      else { cout << "Directory already exists." << endl; };
    }
-   catch(std::exception const& e) {
-      cout << "Directory path does not exist." << endl; 
+   // A directory can not be moved into itself or below.
+   for (inode* dir = to_dir.value().get(); ; ) {
+      if (dir == node.get()) {
+         throw command_error (source + ": cannot move into itself");
+      }
+      inode* up = dir->get_contents()->view().find("..");
+      if (up == dir) break;
+      dir = up;
    }
+   inode* dest = state.writable(to_dir.value().get());
+   from_dir->get_contents()->unlink(name);
+   dest->get_contents()->link(to_name, node);
+   state.invalidate_dentries();
 }
 
-void fn_prompt (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+void fn_prompt (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    string concat = "";
-   for (size_t i = 1; i < words.size(); i++) { 
-      concat += words.at(i); 
+   for (size_t i = args.first; i < args.words.size(); i++) { 
+      concat += args.words.at(i); 
       concat += " ";
    }
    if (concat ==  "") concat = " ";
    state.prompt(concat);
 }
 
-void fn_pwd (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
-   auto toPrint = state.get_cwd()->get_contents()->get_path();
-   if (state.get_cwd() != state.get_root()) { 
-      toPrint = toPrint.substr(0, toPrint.size()-1); }
-   cout << toPrint << endl;
+void fn_pwd (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   cout << state.get_cwd()->get_contents()->pathname() << '\n';
 }
 
-void fn_rm (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+void fn_rm (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    auto err = "Cannot delete parent directory or non-existing file.";
-   string toDelete = "";
-   try {
-      auto toDeleteFrom = state.get_inode_ptr_from_path(
-         words.at(1), toDelete);
-      if (toDelete == ".." || toDelete == ".." || toDelete == "/") 
-         { throw file_error("Going to catch"); }
-      toDeleteFrom->get_contents()->remove(toDelete); 
-   }
-   catch(std::exception const& e) {
-      cout << err << endl; return; }
-   // 
+   const resolved_path& path = args.paths.front();
+   string_view toDelete = path.name;
+   if (not path.dir or toDelete == ".." || toDelete == "/") {
+      cout << err << '\n'; return; }
+   inode* dir = path.dir.value().get();
+   if (dir->get_contents()->view().find(toDelete) != nullptr) {
+      dir = state.writable(dir); }
+   dir->get_contents()->remove(toDelete); 
 }
 
-void fn_rmr (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state); DEBUGF ('c', words);
+void fn_rmr (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    auto err = "Cannot delete parent directory on non-existing dir.";
-   string toDelete = "";
+   const resolved_path& path = args.paths.front();
+   string_view toDelete = path.name;
+   if (not path.dir or toDelete == "." || toDelete == ".." 
+       || toDelete == "/") { 
+      cout << err << '\n'; return; }
+   inode* dir = path.dir.value().get();
+   if (dir->get_contents()->view().find(toDelete) != nullptr) {
+      dir = state.writable(dir); }
+   state.reclaim(dir->get_contents()->rmr(toDelete), inode_ptr (dir));
+}
+
+void fn_save (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
    try {
-      auto toDeleteFrom = state.get_inode_ptr_from_path(
-         words.at(1), toDelete);
-      if (toDelete == "." || toDelete == ".." || toDelete == "/") 
-         { throw file_error("Going to catch"); }
-      toDeleteFrom->get_contents()->rmr(toDelete); 
+      state.save_image (string (args.words.at(args.first)));
+   }catch (runtime_error& error) {
+      throw command_error (string ("save: ") + error.what());
+   }
+}
+
+void fn_restore (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   string_view name = args.words.at(args.first);
+   if (not state.restore (name)) {
+      throw command_error ("restore: " + string (name)
+                           + ": no such snapshot");
+   }
+}
+
+void fn_snapshot (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   state.snapshot (args.words.at(args.first));
+}
+
+void fn_snapshots (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   for (const auto& [name, tree]: state.get_snapshots()) {
+      cout << name << '\n';
+   }
+}
+
+// print_stat -
+//    One line of stat:  the inode number, the type, the size, as ls
+//    shows it, and the pathname.
+
+static void print_stat (inode* node) {
+   auto& contents = node->get_contents();
+   put_right (cout, node->get_inode_nr(), 6);
+   cout << (contents->is_directory() ? "  directory" : "  plain    ");
+   put_right (cout, contents->size(), 8);
+   cout << "  " << contents->pathname() << '\n';
+}
+
+void fn_stat (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   bool numbers = args.option('i');
+   for (size_t index = args.first; index < args.words.size(); ++index) {
+      inode* node = nullptr;
+      const resolved_path& path = args.paths[index - args.first];
+      if (numbers) {
+         node = numbered_inode (state, path.path);
+      }else if (path.dir and path.name == "/") {
+         node = state.get_root().get();
+      }else if (path.dir) {
+         node = path.dir.value()->get_contents()->view()
+                .find(path.name);
       }
-   catch(std::exception const& e) {
-      cout << err << endl; return; }
+      if (node == nullptr) {
+         cout << "stat: " << path.path
+              << ": No such file or directory." << '\n';
+         continue;
+      }
+      print_stat (node);
+   }
+}
 
+void fn_stats (inode_state& state, const command_args& args){
+   DEBUGF ('c', state); DEBUGF ('c', args.words);
+   if (args.operands() > 0) {
+      if (args.words.at(args.first) != "reset") {
+         throw command_error ("stats: usage: stats [reset]");
+      }
+      for (command_metrics& stats: command_stats) stats = {};
+      stats_base = state.counters();
+      return;
+   }
+   cout << "command       calls   errors      p50      p99     p999"
+        << '\n';
+   for (size_t index = 0; index < size (command_stats); ++index) {
+      const command_metrics& stats = command_stats[index];
+      if (stats.calls == 0) continue;
+      string_view name = stats_name (index);
+      cout << name;
+      for (size_t pad = name.size(); pad < 10; ++pad) cout << ' ';
+      put_right (cout, stats.calls, 9);
+      put_right (cout, stats.errors, 9);
+      for (double fraction: {0.50, 0.99, 0.999}) {
+         put_right (cout, stats.latency.percentile (fraction), 9);
+      }
+      cout << '\n';
+   }
+   fs_counters counters = stats_since (state);
+   pair<const char*, uint64_t> lines[] {
+      {"inodes_live", counters.inodes_live},
+      {"inode_nr_max", counters.inode_nr_max},
+      {"bytes_stored", counters.bytes_stored},
+      {"components_resolved", counters.components_resolved},
+      {"dirent_copies", counters.dirent_copies},
+      {"dentry_hits", counters.dentry_hits},
+      {"dentry_misses", counters.dentry_misses},
+   };
+   for (const auto& [name, value]: lines) {
+      cout << name;
+      for (size_t pad = strlen (name); pad < 20; ++pad) cout << ' ';
+      put_right (cout, value, 12);
+      cout << '\n';
+   }
 }
 
-void fn_ignore (inode_state& state, const wordvec& words){
+void fn_ignore (inode_state&, const command_args&){
    return;
 }
@@ -3,43 +3,155 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
-#include <unordered_map>
+#include <cstddef>
+#include <string_view>
+#include <vector>
 using namespace std;
 
 #include "file_sys.h"
+#include "journal.h"
 #include "util.h"
 
+// resolved_path -
+//    A path operand, resolved before the command runs:  the
+//    directory holding its last component, or why there is none,
+//    and that last component, which is "/" for the root itself.
+
+struct resolved_path {
+   string_view path;
+   string_view name;
+   file_result<inode_ptr> dir;
+};
+
+// command_args -
+//    What a command is called with:  its registry entry, the words
+//    of the line, the index of the first operand after any options,
+//    and the path operands, resolved, if the command takes paths.
+// option, option_value -
+//    Whether an option was given, and the value given with it.
+
+struct command;
+
+struct command_args {
+   const command& cmd;
+   const wordviews& words;
+   size_t first;
+   const vector<resolved_path>& paths;
+   size_t operands() const { return words.size() - first; }
+   bool option (char letter) const;
+   string_view option_value (char letter) const;
+};
+
 // A couple of convenient usings to avoid verbosity.
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
-using command_hash = unordered_map<string,command_fn>;
+using command_fn = void (*)(inode_state& state,
+                            const command_args& args);
+
+// command -
+//    An entry of the command registry, and all dispatch needs to
+//    know to check a line before calling fn:
+//    min_args, max_args - how many operands there may be, not
+//       counting options.
+//    options - the options it takes, as for getopt(3):  letters,
+//       each followed by a colon if it takes a value.  Options
+//       come before the operands.
+//    paths - which operands are paths to be resolved:  none, the
+//       first, or all.
+//    mutates - whether it changes the tree or the snapshots.  The
+//       dentry cache is emptied before it runs.
+//    journaled - whether it is logged to the journal:  all that
+//       mutate, and cd, which changes what later paths mean.
+//    usage - its synopsis, for errors.
+//    missing - if not empty, what it has always printed to cout
+//       when its operand is missing, instead of its usage.
+
+enum class path_operands {NONE, FIRST, ALL};
+
+struct command {
+   static constexpr size_t UNLIMITED {~size_t (0)};
+   string_view name;
+   command_fn fn;
+   size_t min_args;
+   size_t max_args;
+   string_view options;
+   path_operands paths;
+   bool mutates;
+   bool journaled;
+   string_view usage;
+   string_view missing;
+};
 
 // command_error -
-//    Extend runtime_error for throwing exceptions related to this 
+//    Extend runtime_error for throwing exceptions related to this
 //    program.
 
 class command_error: public runtime_error {
-   public: 
+   public:
       explicit command_error (const string& what);
 };
 
 // execution functions -
 
-void fn_cat    (inode_state& state, const wordvec& words);
-void fn_cd     (inode_state& state, const wordvec& words);
-void fn_echo   (inode_state& state, const wordvec& words);
-void fn_exit   (inode_state& state, const wordvec& words);
-void fn_ls     (inode_state& state, const wordvec& words);
-void fn_lsr    (inode_state& state, const wordvec& words);
-void fn_make   (inode_state& state, const wordvec& words);
-void fn_mkdir  (inode_state& state, const wordvec& words);
-void fn_prompt (inode_state& state, const wordvec& words);
-void fn_pwd    (inode_state& state, const wordvec& words);
-void fn_rm     (inode_state& state, const wordvec& words);
-void fn_rmr    (inode_state& state, const wordvec& words);
-void fn_ignore (inode_state& state, const wordvec& words);
-
-command_fn find_command_fn (const string& command);
+void fn_cat       (inode_state& state, const command_args& args);
+void fn_cd        (inode_state& state, const command_args& args);
+void fn_du        (inode_state& state, const command_args& args);
+void fn_echo      (inode_state& state, const command_args& args);
+void fn_exit      (inode_state& state, const command_args& args);
+void fn_ls        (inode_state& state, const command_args& args);
+void fn_lsr       (inode_state& state, const command_args& args);
+void fn_make      (inode_state& state, const command_args& args);
+void fn_mkdir     (inode_state& state, const command_args& args);
+void fn_mv        (inode_state& state, const command_args& args);
+void fn_prompt    (inode_state& state, const command_args& args);
+void fn_pwd       (inode_state& state, const command_args& args);
+void fn_rm        (inode_state& state, const command_args& args);
+void fn_rmr       (inode_state& state, const command_args& args);
+void fn_restore   (inode_state& state, const command_args& args);
+void fn_save      (inode_state& state, const command_args& args);
+void fn_snapshot  (inode_state& state, const command_args& args);
+void fn_snapshots (inode_state& state, const command_args& args);
+void fn_stat      (inode_state& state, const command_args& args);
+void fn_stats     (inode_state& state, const command_args& args);
+void fn_ignore    (inode_state& state, const command_args& args);
+
+// find_command -
+//    Looks a name up in the registry, a perfect hash table built at
+//    compile time, so that a lookup is one hash of the name and at
+//    most one comparison.  Returns nullptr if there is no such
+//    command.
+
+const command* find_command (string_view name);
+
+// dispatch -
+//    Runs one line of words, which must not be empty:  looks up the
+//    command, checks its options and number of operands, logs it to
+//    the journal if it is journaled and there is one, empties the
+//    dentry cache if it mutates, resolves its paths, and calls it.
+//    Errors are thrown as command_error or file_error.
+// run_command -
+//    Dispatches one line of words, which may be empty, and counts it
+//    in the metrics stats shows.  A command_error or file_error is
+//    reported with complain() and does not escape; ysh_exit does.
+
+void dispatch (inode_state& state, const wordviews& words);
+void run_command (inode_state& state, const wordviews& words);
+
+// print_stats_json -
+//    Writes what stats shows as one line of JSON, with the whole
+//    histogram of each command.
+
+void print_stats_json (inode_state& state, ostream& out);
+
+// journal_image -
+//    The image a journal is compacted into:  its name plus ".img".
+//    Whatever the journal holds is to be replayed on top of it.
+// replay_journal -
+//    Runs the commands in a journal that come after the last one
+//    whose effect the tree already holds, with nothing printed.
+//    Returns their number.
+
+string journal_image (const journal& log);
+size_t replay_journal (inode_state& state, journal& log);
 
 // exit_status_message -
 //    Prints an exit message and returns the exit status, as recorded
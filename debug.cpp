@@ -1,8 +1,16 @@
 // $Id: debug.cpp,v 1.15 2020-01-22 14:21:55-08 - - $
 
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <climits>
-#include <iostream>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -18,18 +26,186 @@ void debugflags::setflags (const string& initflags) {
    }
 }
 
-// getflag -
-//    Check to see if a certain flag is on.
+// trace_file -
+//    The trace file, and the sites seen so far, kept to be written
+//    when it is opened.  The lock is taken only to number a site,
+//    once for each DEBUGF.
 
-bool debugflags::getflag (char flag) {
-   // WARNING: Don't TRACE this function or the stack will blow up.
-   return flags_.test (static_cast<unsigned char> (flag));
+struct site_info {
+   char flag;
+   int line;
+   const char* file;
+   const char* function;
+};
+
+static atomic<int> trace_fd {-1};
+static mutex site_lock;
+static vector<site_info> sites;
+static atomic<uint32_t> next_thread {0};
+
+// write_chunk -
+//    Writes a chunk to the trace file in one writev(2), so that the
+//    chunks of threads writing at once are never interleaved, since
+//    the file is opened to append.  Trace is lost on failure, rather
+//    than failing the command that traced.
+
+static void write_chunk (uint32_t kind, iovec* parts, size_t count) {
+   int fd = trace_fd.load (memory_order_acquire);
+   if (fd < 0) return;
+   trace_chunk chunk {kind, 0};
+   for (size_t part = 1; part < count; ++part) {
+      chunk.bytes += parts[part].iov_len;
+   }
+   parts[0] = {&chunk, sizeof chunk};
+   while (writev (fd, parts, count) < 0 and errno == EINTR) {}
+}
+
+static void write_site (uint32_t id, const site_info& site) {
+   trace_site_record record {id, static_cast<uint32_t> (site.line),
+                             static_cast<uint32_t> (strlen (site.file)),
+                             static_cast<uint32_t> (
+                                strlen (site.function)),
+                             site.flag, {}};
+   iovec parts[] {
+      {nullptr, 0},
+      {&record, sizeof record},
+      {const_cast<char*> (site.file), record.file_length},
+      {const_cast<char*> (site.function), record.function_length},
+   };
+   write_chunk (trace_chunk::SITE, parts, size (parts));
+}
+
+void trace::start (const string& filename) {
+   int fd = open (filename.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+   if (fd < 0) {
+      throw runtime_error (filename + ": " + strerror (errno));
+   }
+   trace_header header;
+   memcpy (header.magic, trace_header::MAGIC, sizeof header.magic);
+   while (write (fd, &header, sizeof header) < 0 and errno == EINTR) {}
+   lock_guard<mutex> lock (site_lock);
+   trace_fd.store (fd, memory_order_release);
+   for (size_t id = 0; id < sites.size(); ++id) {
+      write_site (id, sites[id]);
+   }
+}
+
+trace_site::trace_site (char flag, const char* file, int line,
+                        const char* function): flag_ (flag) {
+   lock_guard<mutex> lock (site_lock);
+   id_ = sites.size();
+   sites.push_back ({flag, line, file, function});
+   write_site (id_, sites.back());
+}
+
+// trace_payload -
+//    The streambuf a payload is written through, straight into its
+//    event as its put area, dropping whatever does not fit.
+// place -
+//    Makes the put area the range given, with next as the next char
+//    to put.
+
+class trace_payload: public streambuf {
+   public:
+      void place (char* begin, char* next, char* end) {
+         setp (begin, end);
+         pbump (next - begin);
+      }
+      char* begin() const { return pbase(); }
+      char* next() const { return pptr(); }
+      char* end() const { return epptr(); }
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         return traits_type::not_eof (ch);
+      }
+};
+
+// trace_ring -
+//    The events of one thread, written out as a chunk when all
+//    CAPACITY are used and when the thread ends.  While records are
+//    open, the ring can not be written out under them, so when it is
+//    full, a nested record goes to spare_ and is lost.  Those lost
+//    are counted in dropped_, and the count written with the events
+//    as a DROPPED chunk, so that ytrace can tell a trace is short.
+
+class trace_ring {
+   public:
+      static constexpr size_t CAPACITY {1024};
+   private:
+      vector<trace_event> events_;
+      size_t used_ {0};
+      uint64_t dropped_ {0};
+      trace_event spare_ {};
+   public:
+      uint32_t thread {next_thread.fetch_add (1)};
+      size_t open {0};
+      trace_payload payload;
+      ostream out {&payload};
+      trace_ring() { out << boolalpha; }
+      ~trace_ring() { flush(); }
+      trace_event* claim();
+      void flush();
+};
+
+trace_event* trace_ring::claim() {
+   if (events_.empty()) events_.resize (CAPACITY);
+   if (used_ == CAPACITY) {
+      if (open > 0) {
+         ++dropped_;
+         return &spare_;
+      }
+      flush();
+   }
+   return &events_[used_++];
+}
+
+void trace_ring::flush() {
+   if (used_ > 0) {
+      iovec parts[] {
+         {nullptr, 0},
+         {events_.data(), used_ * sizeof (trace_event)},
+      };
+      write_chunk (trace_chunk::EVENTS, parts, size (parts));
+      used_ = 0;
+   }
+   if (dropped_ > 0) {
+      trace_dropped_record record {thread, 0, dropped_};
+      iovec parts[] {
+         {nullptr, 0},
+         {&record, sizeof record},
+      };
+      write_chunk (trace_chunk::DROPPED, parts, size (parts));
+      dropped_ = 0;
+   }
+}
+
+static thread_local trace_ring ring;
+
+trace_record::trace_record (const trace_site& site):
+              event_ (ring.claim()),
+              saved_begin_ (ring.payload.begin()),
+              saved_next_ (ring.payload.next()),
+              saved_end_ (ring.payload.end()) {
+   event_->nanos = chrono::duration_cast<chrono::nanoseconds> (
+                   chrono::steady_clock::now().time_since_epoch())
+                   .count();
+   event_->site = site.id();
+   event_->thread = ring.thread;
+   event_->flag = site.flag();
+   event_->length = 0;
+   ring.payload.place (event_->payload, event_->payload,
+                       event_->payload + trace_event::PAYLOAD);
+   ++ring.open;
+}
+
+trace_record::~trace_record() {
+   event_->length = ring.payload.next() - event_->payload;
+   ring.payload.place (saved_begin_, saved_next_, saved_end_);
+   --ring.open;
 }
 
-void debugflags::where (char flag, const char* file, int line,
-                        const char* pretty_function) {
-   cout << "DEBUG(" << flag << ") "
-        << file << "[" << line << "] " << endl
-        << "... " << pretty_function << endl;
+ostream& trace_record::out() {
+   return ring.out;
 }
 
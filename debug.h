@@ -5,7 +5,11 @@
 
 #include <bitset>
 #include <climits>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
 #include <string>
+#include <string_view>
 using namespace std;
 
 // debug -
@@ -16,6 +20,13 @@ using namespace std;
 // getflag -
 //    Used by the DEBUGF macro to check to see if a flag has been set.
 //    Not to be called by user code.
+// compiled -
+//    Whether traces of a flag are compiled in at all.  Built with
+//    -DTRACE_FLAGS=\"ij\", only flags i and j are, and every other
+//    DEBUGF is discarded by the compiler, so that it costs nothing,
+//    not even the test of its flag.  Without, all flags are.
+// any -
+//    Whether any flag is set.
 
 class debugflags {
    private:
@@ -23,37 +34,162 @@ class debugflags {
       static flagset_ flags_;
    public:
       static void setflags (const string& optflags);
-      static bool getflag (char flag);
-      static void where (char flag, const char* file, int line,
-                         const char* pretty_function);
+      static bool getflag (char flag) {
+         // WARNING: Don't TRACE this function or the stack blows up.
+         return flags_.test (static_cast<unsigned char> (flag));
+      }
+      static bool any() { return flags_.any(); }
+#ifdef TRACE_FLAGS
+      static constexpr bool compiled (char flag) {
+         return string_view (TRACE_FLAGS).find (flag)
+                != string_view::npos;
+      }
+#else
+      static constexpr bool compiled (char) { return true; }
+#endif
+};
+
+// trace -
+//    The binary trace that DEBUGF writes to, instead of cout and
+//    cerr.  Each trace is an event of a fixed size:  when it was
+//    made, on which thread, by which DEBUGF (its site), and the
+//    first PAYLOAD bytes of what the DEBUGF would have printed.
+//    Each thread records events into a ring of its own, so that no
+//    lock is taken, and writes the ring to the trace file in one
+//    write(2) as it fills and as the thread ends.  Each site is
+//    written to the file once, as first used, with its flag, file,
+//    line, and function, so that events need only carry its number.
+//    ytrace decodes the file.
+//
+//    The file is a header, then chunks, each a trace_chunk followed
+//    by bytes bytes:  for SITE, a trace_site_record and then its
+//    file and function names; for EVENTS, trace_events; for DROPPED,
+//    a trace_dropped_record, the number of events a thread lost
+//    since its last one.  Integers are in the byte order of the
+//    machine.
+// start -
+//    Opens the trace file, truncating it, and writes the sites used
+//    so far.  Until it is, events are recorded but not written.
+//    Throws runtime_error on failure.
+
+struct trace_header {
+   static constexpr char MAGIC[8] {'y', 's', 'h', 't', 'r', 'c',
+                                   '\0', '\1'};
+   char magic[8];
+};
+
+struct trace_chunk {
+   enum : uint32_t {SITE, EVENTS, DROPPED};
+   uint32_t kind;
+   uint32_t bytes;
+};
+
+struct trace_site_record {
+   uint32_t site;
+   uint32_t line;
+   uint32_t file_length;
+   uint32_t function_length;
+   char flag;
+   char unused[7];
+};
+
+struct trace_dropped_record {
+   uint32_t thread;
+   uint32_t unused;
+   uint64_t events;
+};
+
+struct trace_event {
+   static constexpr size_t PAYLOAD {44};
+   uint64_t nanos;        // steady clock
+   uint32_t site;
+   uint32_t thread;       // numbered from 0 as they first trace
+   uint16_t length;       // of the payload
+   char flag;
+   char unused;
+   char payload[PAYLOAD];
+};
+
+static_assert (sizeof (trace_event) == 64);
+
+class trace {
+   public:
+      static void start (const string& filename);
+};
+
+// trace_site -
+//    A DEBUGF, numbered when it first records an event.  Made as a
+//    static in the DEBUGF, so that it is numbered only once.
+
+class trace_site {
+   private:
+      uint32_t id_;
+      char flag_;
+   public:
+      trace_site (char flag, const char* file, int line,
+                  const char* function);
+      trace_site (const trace_site&) = delete;
+      trace_site& operator= (const trace_site&) = delete;
+      uint32_t id() const { return id_; }
+      char flag() const { return flag_; }
 };
 
-
+// trace_record -
+//    One event being recorded:  takes the next slot of the thread's
+//    ring and stamps it, lets the payload be written to out(), which
+//    truncates it at PAYLOAD bytes, and commits it when destroyed.
+//    Records may nest, as when printing a payload traces.
+
+class trace_record {
+   private:
+      trace_event* event_;
+      char* saved_begin_;
+      char* saved_next_;
+      char* saved_end_;
+   public:
+      explicit trace_record (const trace_site& site);
+      ~trace_record();
+      trace_record (const trace_record&) = delete;
+      trace_record& operator= (const trace_record&) = delete;
+      ostream& out();
+};
+
+
 // DEBUGF -
 //    Macro which expands into trace code.  First argument is a
 //    trace flag char, second argument is output code that can
 //    be sandwiched between <<.  Beware of operator precedence.
 //    Example:
 //       DEBUGF ('u', "foo = " << foo);
-//    will print two words and a newline if flag 'u' is  on.
-//    Traces are preceded by filename, line number, and function.
+//    will record an event with two words as its payload if flag 'u'
+//    is on.  The event knows the filename, line number, and
+//    function of the DEBUGF.
+// DEBUGS -
+//    Records an event with no payload and runs a statement, if the
+//    flag is on.
 
 #ifdef NDEBUG
 #define DEBUGF(FLAG,CODE) ;
 #define DEBUGS(FLAG,STMT) ;
 #else
 #define DEBUGF(FLAG,CODE) { \
-           if (debugflags::getflag (FLAG)) { \
-              debugflags::where (FLAG, __FILE__, __LINE__, \
-                                 __PRETTY_FUNCTION__); \
-              cerr << CODE << endl; \
+           if constexpr (debugflags::compiled (FLAG)) { \
+              if (debugflags::getflag (FLAG)) { \
+                 static const trace_site trace_site_ ( \
+                    FLAG, __FILE__, __LINE__, __PRETTY_FUNCTION__); \
+                 trace_record trace_record_ (trace_site_); \
+                 trace_record_.out() << CODE; \
+              } \
            } \
         }
 #define DEBUGS(FLAG,STMT) { \
-           if (debugflags::getflag (FLAG)) { \
-              debugflags::where (FLAG, __FILE__, __LINE__, \
-                                 __PRETTY_FUNCTION__); \
-              STMT; \
+           if constexpr (debugflags::compiled (FLAG)) { \
+              if (debugflags::getflag (FLAG)) { \
+                 static const trace_site trace_site_ ( \
+                    FLAG, __FILE__, __LINE__, __PRETTY_FUNCTION__); \
+                 { trace_record trace_record_ (trace_site_); } \
+                 STMT; \
+              } \
            } \
         }
 #endif
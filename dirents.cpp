@@ -0,0 +1,232 @@
+// $Id: dirents.cpp,v 1.1 2026-10-17 11:02:18-07 - - $
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "dirents.h"
+#include "file_sys.h" // inode must be complete to release one
+
+// lower -
+//    First entry in [begin,end) whose name is not less than the key.
+
+template <typename dirent_ptr>
+static dirent_ptr lower (dirent_ptr begin, dirent_ptr end,
+                         string_view name) {
+   return lower_bound (begin, end, name,
+          [] (const dirent& entry, string_view key) {
+             return string_view (entry.name) < key;
+          });
+}
+
+static bool matches (const dirent* entry, const dirent* end,
+                     string_view name) {
+   return entry != end and string_view (entry->name) == name;
+}
+
+size_t dirent_table::leaf_for (string_view name) const {
+   // The last leaf whose first name is not greater than the key.
+   auto leaf = upper_bound (firsts_.cbegin(), firsts_.cend(), name,
+               [] (string_view key, const string& first) {
+                  return key < string_view (first);
+               });
+   return leaf == firsts_.cbegin() ? 0 : leaf - firsts_.cbegin() - 1;
+}
+
+size_t dirent_table::block_count() const {
+   return layout_ == layout::TREE ? leaves_.size() : 1;
+}
+
+const dirent* dirent_table::block_data (size_t block_nr) const {
+   switch (layout_) {
+      case layout::SMALL: return small_.data();
+      case layout::FLAT:  return flat_.data();
+      case layout::TREE:  return leaves_[block_nr].data();
+   }
+   return nullptr;
+}
+
+size_t dirent_table::block_size (size_t block_nr) const {
+   switch (layout_) {
+      case layout::SMALL: return size_;
+      case layout::FLAT:  return flat_.size();
+      case layout::TREE:  return leaves_[block_nr].size();
+   }
+   return 0;
+}
+
+const inode_ptr* dirent_table::find (string_view name) const {
+   switch (layout_) {
+      case layout::SMALL: {
+         for (size_t itor = 0; itor < size_; ++itor) {
+            if (string_view (small_[itor].name) == name) {
+               return &small_[itor].node;
+            }
+         }
+         return nullptr;
+      }
+      case layout::FLAT: {
+         const dirent* end = flat_.data() + flat_.size();
+         const dirent* entry = lower (flat_.data(), end, name);
+         return matches (entry, end, name) ? &entry->node : nullptr;
+      }
+      case layout::TREE: {
+         const block& leaf = leaves_[leaf_for (name)];
+         const dirent* end = leaf.data() + leaf.size();
+         const dirent* entry = lower (leaf.data(), end, name);
+         return matches (entry, end, name) ? &entry->node : nullptr;
+      }
+   }
+   return nullptr;
+}
+
+inode_ptr* dirent_table::find (string_view name) {
+   const dirent_table& self = *this;
+   return const_cast<inode_ptr*> (self.find (name));
+}
+
+bool dirent_table::insert (string_view name, const inode_ptr& node) {
+   if (find (name) != nullptr) return false;
+   if (layout_ == layout::SMALL and size_ == INLINE_MAX) {
+      small_to_flat();
+   }
+   switch (layout_) {
+      case layout::SMALL: {
+         size_t slot = lower (small_.begin(), small_.begin() + size_,
+                              name) - small_.begin();
+         move_backward (small_.begin() + slot,
+                        small_.begin() + size_,
+                        small_.begin() + size_ + 1);
+         small_[slot] = dirent {string (name), node};
+         break;
+      }
+      case layout::FLAT: {
+         flat_.insert (lower (flat_.begin(), flat_.end(), name),
+                       dirent {string (name), node});
+         if (flat_.size() > TREE_MIN) {
+            ++size_;
+            flat_to_tree();
+            return true;
+         }
+         break;
+      }
+      case layout::TREE: {
+         size_t leaf_nr = leaf_for (name);
+         block& leaf = leaves_[leaf_nr];
+         leaf.insert (lower (leaf.begin(), leaf.end(), name),
+                      dirent {string (name), node});
+         firsts_[leaf_nr] = leaf.front().name;
+         if (leaf.size() > LEAF_MAX) {
+            block upper (make_move_iterator (leaf.begin()
+                                           + LEAF_MAX / 2),
+                         make_move_iterator (leaf.end()));
+            leaf.resize (LEAF_MAX / 2);
+            firsts_.insert (firsts_.begin() + leaf_nr + 1,
+                            upper.front().name);
+            leaves_.insert (leaves_.begin() + leaf_nr + 1,
+                            move (upper));
+         }
+         break;
+      }
+   }
+   ++size_;
+   return true;
+}
+
+bool dirent_table::erase (string_view name) {
+   switch (layout_) {
+      case layout::SMALL: {
+         auto end = small_.begin() + size_;
+         auto entry = lower (small_.begin(), end, name);
+         if (entry == end or entry->name != name) return false;
+         move (entry + 1, end, entry);
+         small_[size_ - 1] = dirent {};
+         --size_;
+         return true;
+      }
+      case layout::FLAT: {
+         auto entry = lower (flat_.begin(), flat_.end(), name);
+         if (entry == flat_.end() or entry->name != name) return false;
+         flat_.erase (entry);
+         --size_;
+         if (size_ < INLINE_MAX) flat_to_small();
+         return true;
+      }
+      case layout::TREE: {
+         size_t leaf_nr = leaf_for (name);
+         block& leaf = leaves_[leaf_nr];
+         auto entry = lower (leaf.begin(), leaf.end(), name);
+         if (entry == leaf.end() or entry->name != name) return false;
+         leaf.erase (entry);
+         if (leaf.empty()) {
+            leaves_.erase (leaves_.begin() + leaf_nr);
+            firsts_.erase (firsts_.begin() + leaf_nr);
+         }else {
+            firsts_[leaf_nr] = leaf.front().name;
+         }
+         --size_;
+         if (size_ < TREE_MIN / 2) tree_to_flat();
+         return true;
+      }
+   }
+   return false;
+}
+
+void dirent_table::clear() {
+   small_ = {};
+   flat_ = {};
+   leaves_ = {};
+   firsts_ = {};
+   size_ = 0;
+   layout_ = layout::SMALL;
+}
+
+void dirent_table::small_to_flat() {
+   flat_.reserve (INLINE_MAX * 2);
+   for (size_t itor = 0; itor < size_; ++itor) {
+      flat_.push_back (move (small_[itor]));
+   }
+   small_ = {};
+   layout_ = layout::FLAT;
+}
+
+void dirent_table::flat_to_small() {
+   move (flat_.begin(), flat_.end(), small_.begin());
+   flat_ = {};
+   layout_ = layout::SMALL;
+}
+
+void dirent_table::flat_to_tree() {
+   DEBUGF ('d', "tree of " << flat_.size() << " entries");
+   for (size_t first = 0; first < flat_.size(); first += LEAF_MAX / 2) {
+      size_t last = min (first + LEAF_MAX / 2, flat_.size());
+      leaves_.emplace_back (make_move_iterator (flat_.begin() + first),
+                            make_move_iterator (flat_.begin() + last));
+      firsts_.push_back (leaves_.back().front().name);
+   }
+   flat_ = {};
+   layout_ = layout::TREE;
+}
+
+void dirent_table::tree_to_flat() {
+   DEBUGF ('d', "flat of " << size_ << " entries");
+   flat_.reserve (size_);
+   for (block& leaf: leaves_) {
+      move (leaf.begin(), leaf.end(), back_inserter (flat_));
+   }
+   leaves_ = {};
+   firsts_ = {};
+   layout_ = layout::FLAT;
+}
+
+dirent_table::const_iterator dirent_table::begin() const {
+   if (size_ == 0) return end();
+   return const_iterator (this, 0);
+}
+
+dirent_table::const_iterator dirent_table::end() const {
+   return const_iterator (this, block_count());
+}
+
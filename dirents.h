@@ -0,0 +1,141 @@
+// $Id: dirents.h,v 1.1 2026-10-17 11:02:18-07 - - $
+
+// dirents -
+//    The table of entries held by a directory.  Entries are kept
+//    sorted by name, so iteration is lexicographic, as ls and lsr
+//    require.  The representation adapts to the size of the table:
+//    SMALL -
+//       Up to INLINE_MAX entries are stored inline in the table
+//       itself and searched linearly.  No allocation at all.
+//    FLAT -
+//       Up to TREE_MIN entries are stored in one sorted contiguous
+//       array and found by binary search.
+//    TREE -
+//       Larger tables become a B+tree of height two:  sorted leaf
+//       blocks of at most LEAF_MAX entries, indexed by the first
+//       name in each leaf.  Inserts and erases only move entries
+//       within one leaf, except that a leaf splitting or emptying
+//       moves the index, which is O(leaves), at most once every
+//       LEAF_MAX / 2 inserts.
+//    This is not the general B+tree that 100,000 entries might
+//    call for, which would add levels as the index grew.  At that
+//    size the index is some 800 leaves, and even at 1,000,000
+//    moving it costs less per insert, over the inserts between
+//    splits, than moving half a leaf does, so a third level would
+//    only add a search.  TREE_MIN is set where an insert into the
+//    middle of a flat array, which moves half of it, grows to some
+//    80 KiB, while lookups and iteration still gain from one
+//    contiguous array.  It is well below 100,000, so that no large
+//    table pays for the flat array.
+//    All lookups take a string_view, so no string is built just to
+//    search for a name.
+
+#ifndef __DIRENTS_H__
+#define __DIRENTS_H__
+
+#include <array>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+#include "ref_ptr.h"
+#include "slab.h"
+
+class inode;
+using inode_ptr = ref_ptr<inode>;
+
+struct dirent {
+   string name;
+   inode_ptr node;
+};
+
+// class dirent_table -
+// find -
+//    Returns a pointer to the inode_ptr named, or nullptr.
+// insert -
+//    Adds an entry, returning false if the name is already present.
+// erase -
+//    Removes an entry, returning false if it was not present.
+// begin, end -
+//    Iterate over the entries in name order.
+
+class dirent_table {
+   public:
+      static constexpr size_t INLINE_MAX {4};
+      static constexpr size_t TREE_MIN {4096};
+      static constexpr size_t LEAF_MAX {256};
+      class const_iterator;
+      using iterator = const_iterator;
+      size_t size() const { return size_; }
+      bool empty() const { return size_ == 0; }
+      inode_ptr* find (string_view name);
+      const inode_ptr* find (string_view name) const;
+      bool insert (string_view name, const inode_ptr& node);
+      bool erase (string_view name);
+      void clear();
+      const_iterator begin() const;
+      const_iterator end() const;
+   private:
+      enum class layout {SMALL, FLAT, TREE};
+      using block = vector<dirent,slab_allocator<dirent>>;
+      layout layout_ {layout::SMALL};
+      size_t size_ {0};
+      array<dirent,INLINE_MAX> small_;
+      block flat_;
+      vector<block> leaves_;
+      vector<string> firsts_; // first name in each leaf
+      size_t leaf_for (string_view name) const;
+      size_t block_count() const;
+      const dirent* block_data (size_t block_nr) const;
+      size_t block_size (size_t block_nr) const;
+      void small_to_flat();
+      void flat_to_small();
+      void flat_to_tree();
+      void tree_to_flat();
+};
+
+class dirent_table::const_iterator {
+   friend class dirent_table;
+   private:
+      const dirent_table* table {nullptr};
+      size_t block_nr {0};
+      size_t entry_nr {0};
+      const_iterator (const dirent_table* table_, size_t block_nr_):
+                      table (table_), block_nr (block_nr_) {}
+   public:
+      using iterator_category = forward_iterator_tag;
+      using value_type = dirent;
+      using difference_type = ptrdiff_t;
+      using pointer = const dirent*;
+      using reference = const dirent&;
+      const_iterator() = default;
+      reference operator*() const {
+         return table->block_data (block_nr)[entry_nr];
+      }
+      pointer operator->() const { return &**this; }
+      const_iterator& operator++() {
+         if (++entry_nr == table->block_size (block_nr)) {
+            ++block_nr;
+            entry_nr = 0;
+         }
+         return *this;
+      }
+      const_iterator operator++ (int) {
+         const_iterator result = *this;
+         ++*this;
+         return result;
+      }
+      bool operator== (const const_iterator& that) const {
+         return block_nr == that.block_nr
+            and entry_nr == that.entry_nr;
+      }
+      bool operator!= (const const_iterator& that) const {
+         return not (*this == that);
+      }
+};
+
+#endif
+
@@ -1,16 +1,34 @@
 // $Id: file_sys.cpp,v 1.8 2020-10-22 14:37:26-07 - - $
 
 #include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
 #include <stdexcept>
 #include <unordered_map>
-#include <iomanip>      // std::setw
 
 using namespace std;
 
 #include "debug.h"
 #include "file_sys.h"
-
-size_t inode::next_inode_nr {1};
+#include "image.h"
+#include "output.h"
+#include "work_pool.h"
+
+atomic<size_t> inode::live_inodes {0};
+atomic<uint64_t> inode::next_generation {0};
+size_t directory::dirent_copies {0};
+size_t inode::current_epoch {0};
+atomic_flag inode_table::busy_ = ATOMIC_FLAG_INIT;
+vector<unique_ptr<inode*[]>> inode_table::pages_;
+size_t inode_table::end_ {1}; // 0 is no inode
+vector<size_t> inode_table::free_;
+size_t inode_table::sharing_ {0};
+
+size_t dentry_key_hash::operator() (const dentry_key& key) const {
+   return hash<uint64_t>() (key.start_generation)
+        ^ hash<string>() (key.prefix);
+}
 
 struct file_type_hash {
    size_t operator() (file_type type) const {
@@ -27,13 +45,8 @@ ostream& operator<< (ostream& out, file_type type) {
 }
 
 inode_state::inode_state() {
-   root = make_shared<inode>(file_type::DIRECTORY_TYPE);
+   root = make_ref<inode>(file_type::DIRECTORY_TYPE);
    cwd = root;
-   root->contents->get_dirents().insert(
-      pair<string, inode_ptr>(".",root));
-   root->contents->get_dirents().insert(
-      pair<string, inode_ptr>("..",root));
-   root->contents->set_path("/");
    DEBUGF ('i', "root = " << root << ", cwd = " << cwd
       << ", prompt = \"" << prompt() << "\"");
 }
@@ -47,242 +60,818 @@ ostream& operator<< (ostream& out, const inode_state& state) {
    return out;
 }
 
-inode::inode(file_type type): inode_nr (next_inode_nr++) {
+inode::inode(file_type type): inode_nr (inode_table::allocate (this)),
+                              epoch (current_epoch) {
+   live_inodes.fetch_add (1, memory_order_relaxed);
    switch (type) {
       case file_type::PLAIN_TYPE:
-           contents = make_shared<plain_file>(); 
+           contents = make_ref<plain_file>(); 
            break;
       case file_type::DIRECTORY_TYPE:
-           contents = make_shared<directory>(); 
+           contents = make_ref<directory>(this); 
            break;
    }
    DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
 }
 
+inode::inode (const image& from, size_t index, const inode* dir):
+             inode_nr (from.node (index).nr),
+             epoch (dir == nullptr ? current_epoch : dir->epoch) {
+   live_inodes.fetch_add (1, memory_order_relaxed);
+   inode_table::enter (inode_nr, this);
+   if (from.node (index).type == image_inode::DIRECTORY) {
+      contents = make_ref<directory>(this, from, index);
+   }else {
+      contents = make_ref<plain_file>(from, index);
+   }
+}
+
+inode::inode (size_t nr): inode_nr (nr), epoch (current_epoch) {
+   live_inodes.fetch_add (1, memory_order_relaxed);
+   inode_table::enter (inode_nr, this);
+}
+
+inode::~inode() {
+   inode_table::erase (inode_nr, this);
+   live_inodes.fetch_sub (1, memory_order_relaxed);
+}
+
 size_t inode::get_inode_nr() const {
    DEBUGF ('i', "inode = " << inode_nr);
    return inode_nr;
 }
 
+inode_ptr inode::clone() const {
+   inode_ptr copy (new inode (inode_nr));
+   copy->contents = contents->clone (copy.get());
+   DEBUGF ('i', "inode " << inode_nr << ", epoch " << epoch
+          << " -> " << copy->epoch);
+   return copy;
+}
+
+// lock -
+//    Holds busy_ for as long as it lives.
+
+class inode_table::lock {
+   public:
+      lock() {
+         while (busy_.test_and_set (memory_order_acquire)) {
+            this_thread::yield();
+         }
+      }
+      ~lock() { busy_.clear (memory_order_release); }
+      lock (const lock&) = delete;
+      lock& operator= (const lock&) = delete;
+};
+
+// slot -
+//    The slot of a number, making its page if need be.  Called with
+//    the lock held.
+
+inode*& inode_table::slot (size_t nr) {
+   size_t page = nr / PAGE;
+   if (page >= pages_.size()) pages_.resize (page + 1);
+   if (pages_[page] == nullptr) {
+      pages_[page] = make_unique<inode*[]> (PAGE);
+   }
+   return pages_[page][nr % PAGE];
+}
+
+size_t inode_table::allocate (inode* node) {
+   lock guard;
+   size_t nr = end_;
+   if (free_.empty()) ++end_;
+   else {
+      nr = free_.back();
+      free_.pop_back();
+   }
+   slot (nr) = node;
+   return nr;
+}
+
+void inode_table::enter (size_t nr, inode* node) {
+   lock guard;
+   if (nr >= end_) end_ = nr + 1;
+   slot (nr) = node;
+}
+
+void inode_table::erase (size_t nr, const inode* node) {
+   lock guard;
+   inode*& held = slot (nr);
+   if (held != node) return; // a newer copy holds it
+   held = nullptr;
+   if (sharing_ == 0) free_.push_back (nr);
+}
+
+inode* inode_table::find (size_t nr) {
+   lock guard;
+   size_t page = nr / PAGE;
+   if (page >= pages_.size() or pages_[page] == nullptr) return nullptr;
+   return pages_[page][nr % PAGE];
+}
+
+void inode_table::reserve (size_t end) {
+   lock guard;
+   if (end > end_) end_ = end;
+   free_.clear();
+}
+
+void inode_table::share() {
+   lock guard;
+   ++sharing_;
+}
+
+void inode_table::unshare() {
+   lock guard;
+   --sharing_;
+}
+
+size_t inode_table::end() {
+   lock guard;
+   return end_;
+}
+
 
 file_error::file_error (const string& what):
             runtime_error (what) {
 }
 
-const wordvec& base_file::readfile() const {
+string base_file::pathname() const {
+   // The files from this one up, then their names from the top down.
+   vector<const base_file*> files {this};
+   for (;;) {
+      inode* up = files.back()->parent_;
+      if (up == nullptr or up->get_contents().get() == files.back()) {
+         break;
+      }
+      files.push_back (up->get_contents().get());
+   }
+   string path = files.back()->name_;
+   for (auto itor = files.rbegin() + 1; itor != files.rend(); ++itor) {
+      path += '/';
+      path += (*itor)->name_;
+   }
+   return path.empty() ? "/" : path;
+}
+
+const file_data& base_file::readfile() const {
    throw file_error ("is a " + error_file_type());
 }
 
-void base_file::writefile (const wordvec&) {
+void base_file::writefile (const wordviews&) {
    throw file_error ("is a " + error_file_type());
 }
 
-void base_file::remove (const string&) {
+void base_file::remove (string_view) {
    throw file_error ("is a " + error_file_type());
 }
 
-inode_ptr base_file::mkdir (const string&) {
+inode_ptr base_file::mkdir (string_view) {
    throw file_error ("is a " + error_file_type());
 }
 
-inode_ptr base_file::mkfile (const string&) {
+inode_ptr base_file::mkfile (string_view) {
    throw file_error ("is a " + error_file_type());
 }
 
-size_t plain_file::size() const { 
-   size_t size {0};
-   for (auto i : this->data) {
-      size += i.length();
+string_view file_data::word (size_t index) const {
+   size_t begin = index == 0 ? 0 : ends[index - 1] + 1;
+   return string_view (bytes).substr (begin, ends[index] - begin);
+}
+
+void file_data::assign (wordviews::const_iterator begin,
+                        wordviews::const_iterator end) {
+   size_ = 0;
+   for (auto itor = begin; itor != end; ++itor) size_ += itor->size();
+   bytes.clear();
+   bytes.reserve (size_ + (end - begin));
+   ends.clear();
+   ends.reserve (end - begin);
+   for (auto itor = begin; itor != end; ++itor) {
+      bytes.append (*itor);
+      ends.push_back (bytes.size());
+      bytes.push_back (' ');
+   }
+   // Give back what an earlier, longer file left behind.
+   bytes.shrink_to_fit();
+   ends.shrink_to_fit();
+}
+
+void file_data::assign (string_view text) {
+   bytes.assign (text.data(), text.size());
+   ends.clear();
+   for (size_t offset = 0; offset < bytes.size(); ++offset) {
+      if (bytes[offset] == ' ') ends.push_back (offset);
    }
+   size_ = bytes.size() - ends.size();
+   bytes.shrink_to_fit();
+   ends.shrink_to_fit();
+}
+
+ostream& operator<< (ostream& out, const file_data& data) {
+   return out << data.text();
+}
+
+void plain_file::load() const {
+   if (this->image_ == nullptr) return;
+   this->data.assign (image_->text (image_->node (index_)));
+   this->image_ = nullptr;
+}
+
+size_t plain_file::size() const { 
+   size_t size = this->image_ == nullptr ? this->data.size()
+               : image_->node (index_).bytes;
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
-const wordvec& plain_file::readfile() const {
+const file_data& plain_file::readfile() const {
+   load();
    DEBUGF ('i', data);
    return data;
 }
 
-void plain_file::writefile (const wordvec& words) {
-   wordvec::const_iterator it = words.begin();
-   it += 2;
-   this->data.clear();
-   while (it != words.end())
-   {
-      this->data.push_back(*it);
-      it++;
-   }
+void plain_file::writefile (const wordviews& words) {
+   this->data.assign(words.begin() + 2, words.end());
+   this->image_ = nullptr;
    DEBUGF ('i', words);
 }
 
+base_file_ptr plain_file::clone (inode*) const {
+   auto copy = make_ref<plain_file>();
+   copy->data = this->data;
+   copy->image_ = this->image_;
+   copy->index_ = this->index_;
+   copy->relink (this->parent_, this->name_);
+   return copy;
+}
+
+directory::directory (inode* self, const image& from, size_t index):
+           self_ (self), image_ (&from), index_ (index) {
+   parent_ = self;
+   const image_inode& record = from.node (index);
+   below = {record.bytes, record.files, record.dirs};
+}
+
+void directory::load() const {
+   if (this->image_ == nullptr) return;
+   const image_inode& record = image_->node (index_);
+   const image_dirent* entries = image_->entries (record);
+   for (size_t entry = 0; entry < record.count; ++entry) {
+      string_view name = image_->name (entries[entry]);
+      auto node = make_ref<inode>(*image_, entries[entry].node,
+                                  this->self_);
+      node->get_contents()->relink (this->self_, name);
+      this->dirents.insert (name, node);
+   }
+   this->image_ = nullptr;
+   DEBUGF ('m', pathname() << ": " << record.count << " entries");
+}
+
 size_t directory::size() const {
-   size_t size = this->dirents.size();
+   size_t size = (this->image_ == nullptr ? this->dirents.size()
+               : image_->node (index_).count) + 2; // and "." and ".."
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
-void directory::remove (const string& filename) {
+void directory::remove (string_view filename) {
    DEBUGF ('i', filename);
-   if (this->dirents.find(filename) != this->dirents.end()) {
-      try {
-         auto new_dirents = 
-            this->dirents[filename]->get_contents()->get_dirents();
-         if (new_dirents.size() < 3) {
-            this->dirents[filename]->get_contents() = nullptr;
-            this->dirents.erase(filename);
-            return;
-         }
-         else { cout << "Directory is not empty." << endl; return; }
-      }
-      catch(std::exception const& e) {
-         this->dirents[filename]->get_contents() = nullptr;
-         this->dirents.erase(filename);
-         return;
+   load();
+   inode_ptr* found = this->dirents.find(filename);
+   if (found != nullptr) {
+      auto& contents = (*found)->get_contents();
+      if (contents->is_directory()) {
+         if (contents->view().size() >= 3) {
+            cout << "Directory is not empty." << '\n'; return; }
+         contents->relink (found->get(), filename);
+      }else {
+         contents->relink (nullptr, filename);
       }
+      this->add_totals(-contents->totals());
+      this->dirents.erase(filename);
    }
    else {
-      cout << "File does not exist." << endl;
+      cout << "File does not exist." << '\n';
    }
 }
 
-inode_ptr directory::mkdir (const string& dirname) {
+inode_ptr directory::mkdir (string_view dirname) {
    DEBUGF ('i', dirname);
-   inode_ptr dir = make_shared<inode>(file_type::DIRECTORY_TYPE);  
-   string parent_path = this->get_path(); 
-   string new_path = parent_path + dirname + "/";
-   dir->get_contents()->set_path(new_path);
-   this->dirents.insert(pair<string, inode_ptr>(dirname,dir));
-   dir->get_contents()->get_dirents().insert(
-      pair<string, inode_ptr>(".",dir));
-   dir->get_contents()->get_dirents().insert(
-      pair<string, inode_ptr>("..",this->get_dirents().at(".")));
+   load();
+   inode_ptr dir = make_ref<inode>(
+                   file_type::DIRECTORY_TYPE);
+   dir->get_contents()->relink (this->self_, dirname);
+   this->dirents.insert(dirname, dir);
+   this->add_totals(dir->get_contents()->totals());
    return dir;
 }
 
-inode_ptr directory::mkfile (const string& filename) {
-   inode_ptr file = make_shared<inode>(file_type::PLAIN_TYPE);  
-   this->dirents.insert(pair<string, inode_ptr>(filename,file));
-   string parent_path = this->get_path(); 
-   string new_path = parent_path + filename + "";
-   file->get_contents()->set_path(new_path);
+inode_ptr directory::mkfile (string_view filename) {
+   load();
+   inode_ptr file = make_ref<inode>(file_type::PLAIN_TYPE);
+   this->dirents.insert(filename, file);
+   file->get_contents()->relink (this->self_, filename);
+   this->add_totals(file->get_contents()->totals());
    DEBUGF ('i', filename);
    return file;
 }
 
-void directory::print_dirents() const {
-   auto _path = this->path;
-   if (_path.length() <  2) cout << "/: " << endl;
-   else cout << path.substr(0, _path.size()-1) << ":" << endl; 
-   map<string, inode_ptr>::const_iterator it = this->dirents.begin();
-   while (it != this->dirents.end())
-   {
-      cout << setw(6) << it->second->get_inode_nr() << "  ";
-      cout << setw(6) << it->second->get_contents()->size() << "  ";
-      cout 
-         << it->first 
-         << it->second->get_contents()->dir_tail() 
-         << endl;
-      it++;
+void directory::add_totals(const subtree_totals& delta) {
+   directory* dir = this;
+   for (;;) {
+      dir->below += delta;
+      if (dir->parent_ == dir->self_) break; // The parent of / is /.
+      dir = static_cast<directory*>(
+         dir->parent_->get_contents().get());
+   }
+}
+
+base_file_ptr directory::clone (inode* self) const {
+   load();
+   auto copy = make_ref<directory>(self);
+   copy->dirents = this->dirents;
+   dirent_copies += this->dirents.size();
+   if (this->parent_ != this->self_) copy->parent_ = this->parent_;
+   copy->name_ = this->name_;
+   copy->below = this->below;
+   copy->adopt_children();
+   return copy;
+}
+
+void directory::adopt_children() {
+   if (not loaded()) return; // made with the right parent
+   for (const auto& entry: this->dirents) {
+      entry.node->get_contents()->relink (this->self_, entry.name);
+   }
+}
+
+// print_dirent -
+//    One line of ls:  the inode number, size, and name of a dirent.
+
+static void print_dirent (ostream& out, inode* node, string_view name) {
+   put_right (out, node->get_inode_nr(), 6);
+   out << "  ";
+   put_right (out, node->get_contents()->size(), 6);
+   out << "  " << name << node->get_contents()->dir_tail() << '\n';
+}
+
+void directory::print_dirents (ostream& out,
+                               const string& path) const {
+   load();
+   out << path << (path == "/" ? ": \n" : ":\n");
+   // Dot and dotdot are not stored, so they are merged in where
+   // they sort among the names.
+   bool dot = false;
+   bool dotdot = false;
+   for (const auto& entry: this->dirents) {
+      if (not dot and entry.name > ".") {
+         print_dirent (out, this->self_, ".");
+         dot = true;
+      }
+      if (not dotdot and entry.name > "..") {
+         print_dirent (out, this->parent_, "..");
+         dotdot = true;
+      }
+      print_dirent (out, entry.node.get(), entry.name);
    }
+   if (not dot) print_dirent (out, this->self_, ".");
+   if (not dotdot) print_dirent (out, this->parent_, "..");
 }
 
 //
 // get_inode_ptr_from_path: 
 //    returns the second-to-last file in given param "path"
+//    The directory found for each (start, prefix) pair is kept in
+//    the dentry cache until the tree is next changed, or the cache
+//    is full.
 //
-inode_ptr& inode_state::get_inode_ptr_from_path(
-   string path, string& tail)
+file_result<inode_ptr> inode_state::get_inode_ptr_from_path(
+   string_view path, string_view& tail)
 {
-   string front = "";
-   auto files = split(path, "/");
-   if (files.size() < 1) files.push_back("/");
-   tail = files.back();
-   size_t counter = 0;
-   try {
-      if (tail == "/") { 
-         return this->get_root()->get_contents()->recur_get_dir(
-            files, counter); 
-         }
-      else { 
-         return this->get_cwd()->get_contents()->recur_get_dir(
-            files, counter); }
-   } 
-   catch(std::exception const& e) {
-      throw file_error("Exiting");
+   // Split off the last component by hand, so that a hit in the
+   // cache never has to split the whole path.
+   size_t last = path.find_last_not_of('/');
+   size_t first = 0;
+   if (last == string_view::npos) tail = "/";
+   else {
+      first = path.find_last_of('/', last);
+      first = first == string_view::npos ? 0 : first + 1;
+      tail = path.substr(first, last + 1 - first);
+   }
+   inode_ptr& start = tail == "/" ? this->get_root() : this->get_cwd();
+   probe_.start_nr = start->get_inode_nr();
+   probe_.start_generation = start->get_generation();
+   probe_.prefix.assign(path.data(), first);
+   auto cached = dentries.find(probe_);
+   if (cached != dentries.end()) {
+      ++dentry_hits_;
+      return cached->second;
+   }
+   ++dentry_misses_;
+   split(probe_.prefix, "/", components_);
+   components_resolved_ += components_.size();
+   inode* dir = start.get();
+   for (string_view file: components_) {
+      auto view = dir->get_contents()->view();
+      if (not view.valid()) return file_errc::NOT_A_DIRECTORY;
+      dir = view.find(file);
+      if (dir == nullptr) return file_errc::NO_SUCH_FILE;
+   }
+   if (not dir->get_contents()->is_directory()) {
+      return file_errc::NOT_A_DIRECTORY;
+   }
+   if (dentries.size() >= MAX_DENTRIES) invalidate_dentries();
+   return dentries.emplace(probe_, inode_ptr (dir))
+          .first->second;
+}
+
+fs_counters inode_state::counters() {
+   return {static_cast<int64_t> (inode::live()),
+           static_cast<int64_t> (inode_table::end()) - 1,
+           root->get_contents()->totals().bytes,
+           components_resolved_, directory::copied_dirents(),
+           dentry_hits_, dentry_misses_};
+}
+
+void inode_state::invalidate_dentries() {
+   DEBUGF ('i', "dropping " << dentries.size() << " dentries");
+   dentries.clear();
+}
+
+// walk_paths -
+//    The pathnames of the directories of a preorder walk.  Each is
+//    made from that of its parent, which the walk has just passed
+//    through, so a walk builds them in O(1) each, and not from the
+//    root up every time, which is quadratic in a tall tree.
+
+class walk_paths {
+   private:
+      vector<pair<const base_file*, size_t>> above_;
+      string path_;
+   public:
+      const string& operator() (const base_file& dir);
+};
+
+const string& walk_paths::operator() (const base_file& dir) {
+   const base_file* up = dir.parent() == nullptr ? nullptr
+                       : dir.parent()->get_contents().get();
+   while (not above_.empty() and above_.back().first != up) {
+      above_.pop_back();
+   }
+   if (above_.empty()) path_ = dir.pathname();
+   else {
+      path_.resize (above_.back().second);
+      if (path_ != "/") path_ += '/';
+      path_ += dir.name();
    }
+   above_.emplace_back (&dir, path_.size());
+   return path_;
 }
 
-inode_ptr& directory::recur_get_dir(wordvec& files, size_t counter) {
-   try
+// lsr_task -
+//    The listing of one subtree, rendered by one task of a parallel
+//    lsr.  Subtrees big enough to be tasks of their own are left out
+//    of its text, and spliced back in at the offsets recorded.
+// lsr_job -
+//    A parallel lsr:  its pool, the number of directories a subtree
+//    needs to get a task of its own, and the tasks spawned, owned by
+//    the worker that spawned them, so that no locking is needed.
+
+struct lsr_task {
+   base_file* top;
+   string text;
+   vector<pair<size_t, const lsr_task*>> splices;
+};
+
+struct lsr_job {
+   static constexpr size_t TASKS_PER_THREAD {16};
+   work_pool pool;
+   int64_t grain;
+   vector<vector<unique_ptr<lsr_task>>> tasks;
+   lsr_job (size_t threads, int64_t dirs):
+      pool (threads),
+      grain (max<int64_t> (1, dirs / (threads * TASKS_PER_THREAD))),
+      tasks (threads) {}
+};
+
+// render_lsr -
+//    Renders the subtree of a task, spawning a task for each big
+//    subtree instead of walking into it.  Reads the tree through
+//    raw pointers only, so no reference count is touched.
+
+static void render_lsr (lsr_job& job, size_t self, lsr_task& task) {
+   ostringstream out;
+   walk_paths paths;
+   walk_tree (*task.top, walk_order::PREORDER, [&] (base_file& dir) {
+      if (&dir != task.top and dir.totals().dirs >= job.grain) {
+         job.tasks[self].push_back (
+            make_unique<lsr_task> (lsr_task {&dir, "", {}}));
+         lsr_task* child = job.tasks[self].back().get();
+         task.splices.emplace_back (out.tellp(), child);
+         job.pool.spawn (self, [&job, child] (size_t worker) {
+            render_lsr (job, worker, *child);
+         });
+         return false;
+      }
+      dir.print_dirents (out, paths (dir));
+      return true;
+   });
+   task.text = out.str();
+}
+
+// write_lsr -
+//    Writes out the text of a task with those of the tasks spliced
+//    into it, depth first, as the sequential walk would have.
+
+static void write_lsr (ostream& out, const lsr_task& top) {
+   struct frame {
+      const lsr_task* task;
+      size_t splice;
+      size_t offset;
+   };
+   vector<frame> stack {{&top, 0, 0}};
+   while (not stack.empty()) {
+      frame& current = stack.back();
+      const lsr_task& task = *current.task;
+      const char* text = task.text.data();
+      if (current.splice == task.splices.size()) {
+         out.write (text + current.offset,
+                    task.text.size() - current.offset);
+         stack.pop_back();
+         continue;
+      }
+      auto [at, child] = task.splices[current.splice++];
+      out.write (text + current.offset, at - current.offset);
+      current.offset = at;
+      stack.push_back ({child, 0, 0});
+   }
+}
+
+void directory::recur_lsr (size_t threads) {
+   if (threads <= 1) {
+      walk_paths paths;
+      walk_tree (*this, walk_order::PREORDER, [&] (base_file& dir) {
+         dir.print_dirents (cout, paths (dir));
+      });
+      return;
+   }
+   lsr_job job (threads, this->totals().dirs);
+   lsr_task top {this, "", {}};
+   job.pool.run ([&job, &top] (size_t self) {
+      render_lsr (job, self, top);
+   });
+   write_lsr (cout, top);
+}
+
+inode_ptr directory::rmr(string_view filename) {
+   load();
+   inode_ptr* found = this->dirents.find(filename);
+   if (found == nullptr or not (*found)->get_contents()->is_directory())
    {
-      if (counter < files.size() - 1) { 
-         if (this->get_dirents().find(files.at(counter)) 
-            == this->get_dirents().end()) { 
-            throw file_error("Did not find. Going to catch"); 
-            };
-         return this->get_dirents()[files.at(counter)]
-            ->get_contents()->recur_get_dir(files, counter + 1);
+      this->remove(filename); // Handles null and plain files
+      return nullptr;
+   }
+   return unlink (filename);
+}
+
+void directory::link (string_view name, const inode_ptr& node) {
+   load();
+   auto& contents = node->get_contents();
+   contents->relink (this->self_, name);
+   this->dirents.insert (name, node);
+   this->add_totals (contents->totals());
+}
+
+inode_ptr directory::unlink (string_view name) {
+   load();
+   inode_ptr node = *this->dirents.find (name);
+   this->add_totals (-node->get_contents()->totals());
+   this->dirents.erase (name);
+   return node;
+}
+
+void inode_state::reclaim (inode_ptr subtree, const inode_ptr& parent) {
+   if (subtree == nullptr) return;
+   // The links up from the subtree are still intact until it is
+   // freed, so a walk up from cwd either meets it or reaches a
+   // directory which is its own parent:  / or one removed.
+   const inode* dir = cwd.get();
+   while (dir != subtree.get()) {
+      const inode* up = dir->contents->view().find("..");
+      if (up == dir) break;
+      dir = up;
+   }
+   if (dir == subtree.get()) cwd = parent;
+   // Its own parent, as remove leaves a directory, so that if a
+   // snapshot keeps it, it never links to parent once that is freed.
+   subtree->contents->relink (subtree.get(), subtree->contents->name());
+   if (snapshots_.empty()) reclaimer_.defer (move (subtree));
+                      else reclaimer::release (move (subtree));
+}
+
+void inode_state::snapshot (string_view name) {
+   auto found = snapshots_.find (name);
+   if (found == snapshots_.end()) {
+      if (snapshots_.empty()) inode_table::share();
+      snapshots_.emplace (name, root);
+   }else {
+      reclaimer::release (exchange (found->second, root));
+   }
+   ++inode::current_epoch;
+   DEBUGF ('i', name << ": epoch " << inode::current_epoch);
+}
+
+bool inode_state::restore (string_view name) {
+   auto found = snapshots_.find (name);
+   if (found == snapshots_.end()) return false;
+   invalidate_dentries();
+   inode_ptr old = exchange (root, found->second);
+   cwd = root;
+   ++inode::current_epoch;
+   // The copies in the tree left hold the slots of the inodes they
+   // copied, so those of the tree restored are entered again.
+   inode_table::enter (root->inode_nr, root.get());
+   walk_tree (*root->contents, walk_order::PREORDER,
+              [] (base_file& dir) {
+      auto& contents = static_cast<directory&>(dir);
+      if (not contents.loaded()) return false;
+      contents.adopt_children();
+      for (const auto& entry: contents.view()) {
+         inode_table::enter (entry.node->inode_nr, entry.node.get());
       }
-      else  {
-         return this->get_dirents()["."];
+      return true;
+   });
+   reclaimer::release (move (old));
+   DEBUGF ('i', name << ": epoch " << inode::current_epoch);
+   return true;
+}
+
+inode* inode_state::find_inode (size_t nr) {
+   drain_reclaimer();
+   return inode_table::find (nr);
+}
+
+inode* inode_state::writable (inode* dir) {
+   if (not dir->frozen()) return dir;
+   invalidate_dentries();
+   // Find the frozen directories from dir up, then copy them from
+   // the top down, so each copy is linked into one already copied.
+   vector<inode*> path;
+   for (inode* node = dir; node->frozen(); ) {
+      path.push_back (node);
+      inode* up = node->contents->view().find ("..");
+      if (up == node) break;
+      node = up;
+   }
+   inode* copy = nullptr;
+   for (auto itor = path.rbegin(); itor != path.rend(); ++itor) {
+      inode* node = *itor;
+      inode_ptr clone = node->clone();
+      copy = clone.get();
+      inode* up = copy->contents->view().find ("..");
+      if (up == copy) {
+         root = clone;
+      }else {
+         *up->contents->get_dirents().find (copy->contents->name())
+            = clone;
       }
+      if (cwd.get() == node) cwd = clone;
    }
-   catch(std::exception const& e) {
-      throw file_error("Exiting recursive loop");
+   return copy;
+}
+
+inode* inode_state::writable (inode* dir, string_view filename) {
+   dir = writable (dir);
+   inode_ptr* file = dir->contents->get_dirents().find (filename);
+   if (file == nullptr or not (*file)->frozen()) {
+      return file == nullptr ? nullptr : file->get();
    }
+   *file = (*file)->clone();
+   return file->get();
 }
 
-void directory::recur_lsr() {
+reclaimer::reclaimer(): thread_ (&reclaimer::run, this) {
+}
 
-   map<string, inode_ptr>::const_iterator it = this->dirents.begin();
-   this->print_dirents();
-   while (it != this->dirents.end())
+reclaimer::~reclaimer() {
    {
-      try { 
-         if ( it->first != "." && it->first != "..")  {
-            it->second->get_contents()->recur_lsr(); 
-            }
-         }
-      catch(std::exception const& e) {}
-      it++;
-   }
-}
-
-void directory::rmr(string& filename) {
-   try {
-      if (this->dirents.find(filename) == this->dirents.end() 
-      && filename != ".." && filename != "/") { 
-         throw file_error("Null filename: Going to catch"); };
-      this->dirents[filename]->get_contents()->recur_rmr();
-      this->dirents[filename]->get_contents()
-         ->get_dirents().erase(".");
-      this->dirents[filename]->get_contents()
-         ->get_dirents().erase("..");
-      this->dirents[filename]->get_contents() = nullptr;
-      this->dirents[filename] = nullptr;
-      this->dirents.erase(filename);
+      lock_guard<mutex> guard (lock_);
+      stopping_ = true;
    }
-   catch(std::exception const& e) {
-      this->remove(filename); // Handles null
+   wake_.notify_one();
+   thread_.join();
+   for (inode_ptr& tree: queue_) leak (move (tree));
+}
+
+void reclaimer::defer (inode_ptr subtree) {
+   auto totals = subtree->get_contents()->totals();
+   if (totals.files + totals.dirs < INLINE_NODES) {
+      release (move (subtree));
+      return;
+   }
+   {
+      lock_guard<mutex> guard (lock_);
+      queue_.push_back (move (subtree));
    }
+   wake_.notify_one();
+}
+
+void reclaimer::drain() {
+   unique_lock<mutex> guard (lock_);
+   idle_.wait (guard, [this] { return queue_.empty() and not busy_; });
+}
+
+void inode_state::load_image (const string& filename) {
+   images_.push_back (make_unique<image> (filename));
+   const image& loaded = *images_.back();
+   invalidate_dentries();
+   inode_ptr old = exchange (root, make_ref<inode>(loaded, 0));
+   cwd = root;
+   journal_seq_ = loaded.header().journal_seq;
+   reclaimer::release (move (old));
+   // Only now, so that no number of the image is freed after it.
+   drain_reclaimer();
+   inode_table::reserve (loaded.header().next_inode_nr);
 }
 
-void directory::recur_rmr() {
-   map<string, inode_ptr>::iterator it = this->dirents.begin();
-   while (it != this->dirents.end()) {
-      try { 
-         if ( it->first != "." && it->first != "..")  {
-            if (it->second == nullptr) break;
-            this->dirents[it->first]->get_contents()->recur_rmr();
-            this->dirents[it->first]->get_contents() = nullptr;
+void inode_state::save_image (const string& filename) {
+   image::save (root.get(), inode_table::end(), journal_seq_,
+                filename);
+}
+
+void reclaimer::release (inode_ptr tree) {
+   if (tree == nullptr) return;
+   vector<inode_ptr> work {move (tree)};
+   while (not work.empty()) release_one (work);
+}
+
+void reclaimer::leak (inode_ptr tree) {
+   static auto& abandoned = *new vector<inode_ptr>();
+   abandoned.push_back (move (tree));
+}
+
+// release_one -
+//    Frees the last node on the work list, after queueing its
+//    subdirectories there.  One referred to from elsewhere is only
+//    dropped from the list.  An entry still referred to from
+//    elsewhere, as from a snapshot, is unlinked from the node freed,
+//    so that it never links to freed memory.
+
+void reclaimer::release_one (vector<inode_ptr>& work) {
+   inode_ptr node = move (work.back());
+   work.pop_back();
+   if (not node.unique()) return;
+   base_file_ptr& contents = node->get_contents();
+   if (contents->is_directory()
+       and static_cast<directory&>(*contents).loaded()) {
+      for (const auto& entry: contents->view()) {
+         base_file& child = *entry.node->get_contents();
+         if (not entry.node.unique() and child.parent() == node.get()) {
+            // Kept by a snapshot, so unlinked from what is freed.
+            child.relink (child.is_directory() ? entry.node.get()
+                                               : nullptr, entry.name);
          }
+         if (child.is_directory()) work.push_back (entry.node);
       }
-      catch(std::exception const& e) {
-         this->dirents[it->first]->get_contents() = nullptr;
+      contents->get_dirents().clear();
+   }
+   contents = nullptr;
+}
+
+// run -
+//    The reclaimer thread.  Takes everything queued at once and
+//    frees it one directory at a time, checking between directories
+//    whether it has been told to stop.  It runs at idle priority,
+//    so that on a busy machine it never delays a command.
+
+void reclaimer::run() {
+   sched_param param {};
+   pthread_setschedparam (pthread_self(), SCHED_IDLE, &param);
+   unique_lock<mutex> guard (lock_);
+   for (;;) {
+      wake_.wait (guard, [this] {
+         return stopping_ or not queue_.empty(); });
+      if (stopping_) return;
+      vector<inode_ptr> work;
+      work.swap (queue_);
+      busy_ = true;
+      guard.unlock();
+      while (not work.empty()
+             and not stopping_.load (memory_order_relaxed)) {
+         release_one (work);
       }
-      it++;
+      guard.lock();
+      for (inode_ptr& tree: work) leak (move (tree));
+      busy_ = false;
+      idle_.notify_all();
    }
 }
 
 inode_state::~inode_state() {
+   dentries.clear();
+   cwd = nullptr;
+   reclaimer::leak (move (root));
+   if (not snapshots_.empty()) inode_table::unshare();
+   for (auto& [name, tree]: snapshots_) reclaimer::leak (move (tree));
 }
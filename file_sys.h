@@ -3,13 +3,21 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <exception>
 #include <iostream>
-#include <memory>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+#include "dirents.h"
 #include "util.h"
 
 // inode_t -
@@ -19,16 +27,307 @@ enum class file_type {PLAIN_TYPE, DIRECTORY_TYPE};
 class inode;
 class base_file;
 class plain_file;
+class file_data;
 class directory;
-using inode_ptr = shared_ptr<inode>;
-using base_file_ptr = shared_ptr<base_file>;
+class image;
+class journal;
+using inode_ptr = ref_ptr<inode>;
+using base_file_ptr = ref_ptr<base_file>;
 ostream& operator<< (ostream&, file_type);
 
 
+// file_errc -
+//    Why a lookup found nothing.
+// file_result -
+//    Either a value or the file_errc saying why there is none.
+//    Lookups return these rather than throwing file_error, since a
+//    missing file is an ordinary outcome for a shell, not an
+//    exceptional one.
+
+enum class file_errc {NONE, NO_SUCH_FILE, NOT_A_DIRECTORY};
+
+template <typename value_t>
+class file_result {
+   private:
+      value_t value_ {};
+      file_errc error_ {file_errc::NONE};
+   public:
+      file_result (value_t value): value_ (move (value)) {}
+      file_result (file_errc error): error_ (error) {}
+      explicit operator bool() const {
+         return error_ == file_errc::NONE;
+      }
+      file_errc error() const { return error_; }
+      value_t& value() { return value_; }
+      const value_t& value() const { return value_; }
+};
+
+// subtree_totals -
+//    Aggregates over a subtree:  the bytes in its plain files, as
+//    plain_file::size() reports them, and the numbers of plain files
+//    and directories in it.  Signed, so they can also be deltas.
+
+struct subtree_totals {
+   int64_t bytes {0};
+   int64_t files {0};
+   int64_t dirs {0};
+   subtree_totals& operator+= (const subtree_totals& that) {
+      bytes += that.bytes; files += that.files; dirs += that.dirs;
+      return *this;
+   }
+   subtree_totals operator-() const { return {-bytes, -files, -dirs}; }
+};
+
+// fs_counters -
+//    What the file system counts, for the stats command:
+//    inodes_live - inodes in memory:  in the tree, in snapshots, or
+//       waiting for the reclaimer.
+//    inode_nr_max - the highest inode number given out, which stays
+//       near inodes_live, since numbers are given out again.
+//    bytes_stored - bytes in the plain files of the tree, as du
+//       counts them.
+//    components_resolved - path components walked by lookups that
+//       missed the dentry cache.
+//    dirent_copies - entries copied into directories copied on
+//       write.
+//    dentry_hits, dentry_misses - lookups served from the dentry
+//       cache, and walked.
+
+struct fs_counters {
+   int64_t inodes_live {0};
+   int64_t inode_nr_max {0};
+   int64_t bytes_stored {0};
+   uint64_t components_resolved {0};
+   uint64_t dirent_copies {0};
+   uint64_t dentry_hits {0};
+   uint64_t dentry_misses {0};
+};
+
+// dir_view -
+//    A borrowed, read-only view of the dirents of a directory.  It
+//    owns nothing and copies nothing, so it is as cheap as a pointer
+//    but must not outlive the directory it views.  The view of a
+//    plain file is empty and not valid().
+// size -
+//    The number of entries, counting "." and "..".
+// find -
+//    Returns the inode named, or nullptr, without touching any
+//    reference counts.  "." and ".." are not stored as dirents, but
+//    found from the links of the directory to itself and its parent.
+// begin, end -
+//    Iterate over the stored entries, which exclude "." and "..".
+
+class dir_view {
+   private:
+      const dirent_table* table_ {nullptr};
+      inode* self_ {nullptr};
+      inode* parent_ {nullptr};
+   public:
+      dir_view() = default;
+      dir_view (const dirent_table& table, inode* self, inode* parent):
+                table_ (&table), self_ (self), parent_ (parent) {}
+      bool valid() const { return table_ != nullptr; }
+      size_t size() const { return valid() ? table_->size() + 2 : 0; }
+      inode* find (string_view name) const {
+         if (not valid()) return nullptr;
+         if (name == ".") return self_;
+         if (name == "..") return parent_;
+         const inode_ptr* found = table_->find (name);
+         return found == nullptr ? nullptr : found->get();
+      }
+      dirent_table::const_iterator begin() const {
+         return valid() ? table_->begin() : end();
+      }
+      dirent_table::const_iterator end() const {
+         return valid() ? table_->end()
+                        : dirent_table::const_iterator();
+      }
+};
+
+// dentry_key -
+//    Key of the path resolution cache:  the inode a walk starts from
+//    and the path up to, but not including, its last component.  The
+//    inode is known by its number and generation, not its address,
+//    since a directory made after it is freed may be given either
+//    of those, but never both.
+
+struct dentry_key {
+   size_t start_nr;
+   uint64_t start_generation;
+   string prefix;
+   bool operator== (const dentry_key& that) const {
+      return start_nr == that.start_nr
+         and start_generation == that.start_generation
+         and prefix == that.prefix;
+   }
+};
+
+struct dentry_key_hash {
+   size_t operator() (const dentry_key& key) const;
+};
+
+// reclaimer -
+//    Frees unlinked subtrees on a thread of its own, so that rmr
+//    returns as soon as the subtree is unlinked.  A subtree is freed
+//    top down:  the subdirectories of a directory are queued before
+//    its dirents are cleared, so no destructor ever recurses.
+// defer -
+//    Queues a subtree to be freed.  Nothing else may refer to it.
+//    One of fewer than INLINE_NODES nodes is freed at once instead,
+//    which costs less than waking the thread, and keeps garbage from
+//    piling up when the thread cannot keep up.
+// release -
+//    Frees a tree at once, on the calling thread.  A node that is
+//    still referred to from elsewhere, as from a snapshot, is only
+//    let go of, and nothing below it is touched.
+// drain -
+//    Waits until everything queued has been freed.
+// dtor -
+//    Stops the thread, abandoning anything not yet freed.
+// leak -
+//    Gives up a tree without freeing it.  At exit, the system takes
+//    the memory back far faster than freeing it node by node.
+
+class reclaimer {
+   public:
+      static constexpr int64_t INLINE_NODES {1024};
+   private:
+      mutex lock_;
+      condition_variable wake_;
+      condition_variable idle_;
+      vector<inode_ptr> queue_;
+      bool busy_ {false};
+      atomic<bool> stopping_ {false};
+      thread thread_;
+      static void release_one (vector<inode_ptr>& work);
+      void run();
+   public:
+      reclaimer();
+      ~reclaimer();
+      reclaimer (const reclaimer&) = delete;
+      reclaimer& operator= (const reclaimer&) = delete;
+      void defer (inode_ptr subtree);
+      void drain();
+      static void release (inode_ptr tree);
+      static void leak (inode_ptr tree);
+};
+
+// inode_table -
+//    Every inode in memory, by number:  pages of PAGE slots indexed
+//    by the number, so that finding one is two indexes, and a free
+//    list of
+//    the numbers of inodes freed, which are given out again before
+//    new ones, so that under churn the numbers stay about as many as
+//    the inodes.  A page is made only when a number in it is first
+//    entered, so that numbers reserved for an image cost nothing
+//    until their inodes are read in.
+//    Shared by every inode_state, as the numbers always
+//    were.  The reclaimer frees inodes on a thread of its own, and a
+//    parallel lsr reads directories in from images, so each call
+//    holds a spin lock, as slab_arena does.
+//    A clone has the number of the inode it copies, so a slot holds
+//    the last inode entered with its number.  While any state has
+//    snapshots, the number of an inode freed may still be that of
+//    a copy of it in a snapshot, so it is dropped, not given out.
+// allocate -
+//    A number for the inode given, and enters it.
+// enter -
+//    Makes the slot of a number hold the inode given.
+// erase -
+//    Empties the slot of a number, if it holds the inode given, and
+//    frees the number.
+// find -
+//    The inode in the slot of a number, or nullptr.  Only safe while
+//    no other thread can be freeing inodes.
+// reserve -
+//    Makes every number below end used, and forgets every number
+//    freed, since an image loaded may have inodes with those numbers
+//    that are not read in yet.  Makes no pages.
+// share, unshare -
+//    Counts states with snapshots.
+// end -
+//    One more than the highest number ever given out.
+
+class inode_table {
+   private:
+      class lock;
+      static constexpr size_t PAGE {4096};
+      static atomic_flag busy_;
+      static vector<unique_ptr<inode*[]>> pages_;
+      static size_t end_;
+      static vector<size_t> free_;
+      static size_t sharing_;
+      static inode*& slot (size_t nr);
+   public:
+      static size_t allocate (inode* node);
+      static void enter (size_t nr, inode* node);
+      static void erase (size_t nr, const inode* node);
+      static inode* find (size_t nr);
+      static void reserve (size_t end);
+      static void share();
+      static void unshare();
+      static size_t end();
+};
+
 // inode_state -
 //    A small convenient class to maintain the state of the simulated
 //    process:  the root (/), the current directory (.), and the
 //    prompt.
+// get_inode_ptr_from_path -
+//    Resolves all but the last component of a path, caching the
+//    directory found in the dentry cache.  Fails with NO_SUCH_FILE
+//    or NOT_A_DIRECTORY instead of throwing.  The cache is emptied
+//    once it holds MAX_DENTRIES, so that a long session that only
+//    reads does not grow it without bound.
+// invalidate_dentries -
+//    Empties the dentry cache.  Must be called by every command
+//    that adds or removes dirents:  mkdir, make, rm, and rmr.
+// dentry_hits, dentry_misses -
+//    Counters of path resolutions served from the cache and walked.
+// counters -
+//    Those and the other counters of the file system.
+// reclaim -
+//    Hands a subtree just unlinked from parent to the reclaimer,
+//    first moving cwd up to parent if it was inside the subtree.
+//    While there are snapshots, which may share the subtree, it is
+//    released at once instead, since the reference counts of shared
+//    nodes must not be touched from another thread.
+// snapshot -
+//    Records the tree under a name, replacing any snapshot of that
+//    name.  O(1):  nothing is copied, but every inode now existing
+//    is frozen, to be copied on its next change.
+// restore -
+//    Makes the snapshot named the tree, with cwd at its root.  The
+//    snapshot is kept, and still shares everything with the tree.
+//    Returns false if there is no such snapshot.
+// get_snapshots -
+//    The snapshots by name.
+// load_image -
+//    Makes the tree the one saved in the image file named, with cwd
+//    at its root.  The image is mapped, and kept mapped for as long
+//    as the state lives, so that nodes are made only as they are
+//    first used.  Throws runtime_error if it can not be.
+// save_image -
+//    Saves the tree to an image file.  Throws runtime_error.
+// get_journal, set_journal -
+//    The journal commands are logged to, if any.  Not owned.
+// journal_seq -
+//    The sequence number of the last command logged or replayed,
+//    which an image records, so that replay can skip what it holds.
+// find_inode -
+//    The inode of the tree with the number given, or nullptr.  O(1),
+//    once the reclaimer has been drained, so that no inode is freed
+//    while it is looked at.  One only in a snapshot may be found, if
+//    the tree has none of its number.  One in an image, in a
+//    directory not yet read in, is not found.
+// writable -
+//    Returns the directory given, or the plain file named in it, as
+//    it may be changed.  One that is frozen is replaced by a copy,
+//    after each frozen directory above it has been, so a change
+//    copies only the path from / down to what changed.
+// dtor -
+//    Leaks the tree rather than tearing it down, since it is only
+//    destroyed as the program exits.
 
 class inode_state {
    friend class inode;
@@ -37,6 +336,18 @@ class inode_state {
       inode_ptr root {nullptr};
       inode_ptr cwd {nullptr}; 
       string prompt_ {"% "};
+      static constexpr size_t MAX_DENTRIES {1 << 16};
+      unordered_map<dentry_key,inode_ptr,dentry_key_hash> dentries;
+      dentry_key probe_ {0, 0, ""};   // reused to search dentries
+      wordviews components_;           // reused to split prefixes
+      size_t dentry_hits_ {0};
+      size_t dentry_misses_ {0};
+      size_t components_resolved_ {0};
+      map<string,inode_ptr,less<>> snapshots_;
+      vector<unique_ptr<image>> images_;
+      journal* journal_ {nullptr};
+      uint64_t journal_seq_ {0};
+      reclaimer reclaimer_;
    public:
       inode_state (const inode_state&) = delete; // copy ctor
       inode_state& operator= (const inode_state&) = delete;
@@ -46,18 +357,59 @@ class inode_state {
       void prompt (const string& str) { this->prompt_ = str; }
 
       inode_ptr& get_cwd() { return cwd; }
-      void set_cwd(inode_ptr& new_cwd) { this->cwd = new_cwd; }
+      void set_cwd(const inode_ptr& new_cwd) { this->cwd = new_cwd; }
       inode_ptr& get_root() { return root; }
 
-      inode_ptr& get_inode_ptr_from_path(string, string&);
+      file_result<inode_ptr> get_inode_ptr_from_path(
+         string_view, string_view&);
+      void invalidate_dentries();
+      size_t dentry_hits() const { return dentry_hits_; }
+      size_t dentry_misses() const { return dentry_misses_; }
+      fs_counters counters();
+      void reclaim (inode_ptr subtree, const inode_ptr& parent);
+      void drain_reclaimer() { reclaimer_.drain(); }
+      void snapshot (string_view name);
+      bool restore (string_view name);
+      inode* find_inode (size_t nr);
+      const map<string,inode_ptr,less<>>& get_snapshots() const {
+         return snapshots_; }
+      inode* writable (inode* dir);
+      inode* writable (inode* dir, string_view filename);
+      void load_image (const string& filename);
+      void save_image (const string& filename);
+      journal* get_journal() { return journal_; }
+      void set_journal (journal* log) { journal_ = log; }
+      uint64_t journal_seq() const { return journal_seq_; }
+      void journal_seq (uint64_t seq) { journal_seq_ = seq; }
 };
 
 // class inode -
 // inode ctor -
 //    Create a new inode of the given type.
+// inode ctor (image) -
+//    Makes the inode with the given index in an image, keeping its
+//    number.  Its contents are not read from the image until used.
+//    One read into a directory takes the epoch of that directory,
+//    so that the children of a frozen one are frozen too.
 // get_inode_nr -
 //    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
+//    small integers, given out by the inode_table, which gives out
+//    those of inodes freed again.
+// get_generation -
+//    A number no other inode made in this process has, even one with
+//    the same inode number, as a clone or one made after it is freed
+//    has.
+// frozen -
+//    Whether the inode existed when the last snapshot was taken or
+//    restored, and so may be shared with a snapshot.  Each inode is
+//    stamped with the epoch it was made in, and every snapshot and
+//    restore starts a new one.
+// clone -
+//    A copy of a frozen inode to be changed in its place.  It keeps
+//    the inode number, and shares whatever is below it.
+// live -
+//    The number of inodes in memory.  Counted atomically, since the
+//    reclaimer frees them on a thread of its own.
 // size -
 //    Returns the size of an inode.  For a directory, this is the
 //    number of dirents.  For a text file, the number of characters
@@ -65,15 +417,30 @@ class inode_state {
 //    number of words.
 //    
 
-class inode {
+class inode: public ref_counted, public slab_object {
    friend class inode_state;
    private:
-      static size_t next_inode_nr;
+      static size_t current_epoch;
+      static atomic<size_t> live_inodes;
+      static atomic<uint64_t> next_generation;
       size_t inode_nr;
+      uint64_t generation {next_generation.fetch_add (
+                           1, memory_order_relaxed)};
+      size_t epoch;
       base_file_ptr contents;
+      explicit inode (size_t nr);
    public:
       inode (file_type);  // declare ctor
+      inode (const image& from, size_t index,
+             const inode* dir = nullptr);
+      ~inode();
+      static size_t live() {
+         return live_inodes.load (memory_order_relaxed);
+      }
       size_t get_inode_nr() const;
+      uint64_t get_generation() const { return generation; }
+      bool frozen() const { return epoch < current_epoch; }
+      inode_ptr clone() const;
       base_file_ptr& get_contents() {
          return contents;
       };
@@ -81,17 +448,31 @@ class inode {
 
 
 // class base_file -
-// Just a base class at which an inode can point.  No data or
-// functions.  Makes the synthesized members useable only from
-// the derived classes.
+// Just a base class at which an inode can point.  Makes the
+// synthesized members useable only from the derived classes.
+// name, parent -
+//    The name of the file in its directory, and that directory:  no
+//    node stores its path.  A plain file not in any directory has no
+//    parent, and a directory not in any is its own, as / is.  One
+//    shared with a snapshot has just the one name and parent, as the
+//    tree has them, and restore relinks it.
+// relink -
+//    Sets both.
+// pathname -
+//    The path of the file, "/" for /, put together from the names
+//    found following the parent links up, so O(depth).  One no
+//    longer in the tree gets a path starting with the name of the
+//    top of the subtree it was removed in, without a slash.
 
 class file_error: public runtime_error {
    public:
       explicit file_error (const string& what);
 };
 
-class base_file {
+class base_file: public ref_counted, public slab_object {
    protected:
+      inode* parent_ {nullptr}; // not owned
+      string name_;
       base_file() = default;
       virtual const string& error_file_type() const = 0;
    public:
@@ -99,105 +480,271 @@ class base_file {
       base_file (const base_file&) = delete;
       base_file& operator= (const base_file&) = delete;
       virtual size_t size() const = 0;
-      virtual const wordvec& readfile() const;
-      virtual void writefile (const wordvec& newdata);
-      virtual void remove (const string& filename);
-      virtual inode_ptr mkdir (const string& dirname);
-      virtual inode_ptr mkfile (const string& filename);
+      virtual bool is_directory() const = 0;
+      virtual subtree_totals totals() const = 0;
+      virtual base_file_ptr clone (inode* self) const = 0;
+      virtual dir_view view() const { return dir_view(); }
+      const string& name() const { return name_; }
+      inode* parent() const { return parent_; }
+      void relink (inode* parent, string_view name) {
+         parent_ = parent;
+         name_ = name;
+      }
+      string pathname() const;
+      virtual const file_data& readfile() const;
+      virtual void writefile (const wordviews& newdata);
+      virtual void remove (string_view filename);
+      virtual inode_ptr mkdir (string_view dirname);
+      virtual inode_ptr mkfile (string_view filename);
       // Base Cases
-      virtual map<string,inode_ptr>& get_dirents() {
-         throw file_error ("is a " + error_file_type()); };
-      virtual string& get_path() { 
+      virtual dirent_table& get_dirents() {
          throw file_error ("is a " + error_file_type()); };
-      virtual void set_path(const string&) { 
-         throw file_error ("is a " + error_file_type()); };
-      virtual void print_dirents() const { 
+      void print_dirents (ostream& out) const {
+         print_dirents (out, pathname()); }
+      virtual void print_dirents (ostream&, const string&) const {
          throw file_error ("is a " + error_file_type()); };
       virtual string dir_tail() const { 
          throw file_error ("is a " + error_file_type()); };
-      virtual inode_ptr& recur_get_dir(wordvec&, size_t) {
+      virtual void recur_lsr (size_t) {
+         throw file_error ("is a " + error_file_type()); };
+      virtual void add_totals(const subtree_totals&) {
          throw file_error ("is a " + error_file_type()); };
-      virtual void recur_lsr() {
+      virtual inode_ptr rmr(string_view) {
          throw file_error ("is a " + error_file_type()); };
-      virtual void rmr(string&) {
+      virtual void link (string_view, const inode_ptr&) {
          throw file_error ("is a " + error_file_type()); };
-      virtual void recur_rmr() {
+      virtual inode_ptr unlink (string_view) {
          throw file_error ("is a " + error_file_type()); };
 };
 
+// class file_data -
+// The words of a plain file, kept in one contiguous buffer exactly
+// as cat prints them:  each word followed by one space.  A compact
+// index records where each word ends, and the size is kept up to
+// date on assign rather than recounted.
+// size -
+//    The sum of the lengths of the words.
+// text -
+//    The whole buffer, ready to be written out.
+// word -
+//    The word with the given index.
+// assign -
+//    Replaces the words with those given, or with those in text as
+//    text() would have returned it.
+
+class file_data {
+   private:
+      string bytes;
+      vector<uint32_t> ends;
+      size_t size_ {0};
+   public:
+      size_t size() const { return size_; }
+      size_t word_count() const { return ends.size(); }
+      string_view text() const { return bytes; }
+      string_view word (size_t index) const;
+      void assign (wordviews::const_iterator begin,
+                   wordviews::const_iterator end);
+      void assign (string_view text);
+};
+
+ostream& operator<< (ostream&, const file_data&);
+
 // class plain_file -
 // Used to hold data.
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
+//    Default file_data is empty.
+// ctor (image) -
+//    A file whose data is still in an image, and is copied out the
+//    first time it is read.  Its size is known without doing so.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
+//    Returns the file_data in the file.
 // writefile -
 //    Replaces the contents of a file with new contents.
 
 class plain_file: public base_file {
    private:
-      wordvec data;
+      mutable file_data data;
+      mutable const image* image_ {nullptr}; // until loaded
+      size_t index_ {0};
+      void load() const;
       virtual const string& error_file_type() const override {
          static const string result = "plain file";
          return result;
       }
-      string path; // now create a getter and sette
    public:
+      plain_file() = default;
+      plain_file (const image& from, size_t index):
+                  image_ (&from), index_ (index) {}
       virtual size_t size() const override;
+      virtual bool is_directory() const override { return false; }
+      virtual subtree_totals totals() const override {
+         return {static_cast<int64_t> (size()), 1, 0}; }
+      virtual base_file_ptr clone (inode* self) const override;
       // These are the only 2 things you can do to a plain_file
-      virtual const wordvec& readfile() const override;         
-      virtual void writefile (const wordvec& newdata) override;
-      virtual void set_path(const string& filepath) override { 
-         this->path = filepath; };
+      virtual const file_data& readfile() const override;
+      virtual void writefile (const wordviews& newdata) override;
       virtual string dir_tail() const override { return ""; };
-      virtual string& get_path() override { return path; };
 };
 
 // class directory -
 // Used to map filenames onto inode pointers.
-// default ctor -
-//    Creates a new map with keys "." and "..".
+// ctor -
+//    Creates an empty table for the directory held by the inode
+//    given.  Dot (.) and dotdot (..) are never stored in the table:
+//    they are the links self_ and parent(), which own nothing, so no
+//    directory keeps itself or its parent alive.  Until mkdir links
+//    it below another, a directory is its own parent, as / is.
+// ctor (image) -
+//    A directory whose entries are still in an image.  They are all
+//    made the first time any is used, as subdirectories and files
+//    which are still in the image in turn.  Its size and totals are
+//    known without doing so.
+// loaded -
+//    Whether the entries have been made.
 // remove -
 //    Removes the file or subdirectory from the current inode.
 //    Throws an file_error if this is not a directory, the file
 //    does not exist, or the subdirectory is not empty.
 //    Here empty means the only entries are dot (.) and dotdot (..).
+//    A directory removed becomes its own parent, so that it never
+//    links to a parent which may be freed before it is.
 // mkdir -
-//    Creates a new directory under the current directory and 
-//    immediately adds the directories dot (.) and dotdot (..) to it.
-//    Note that the parent (..) of / is / itself.  It is an error
-//    if the entry already exists.
+//    Creates a new directory under the current directory, linking
+//    it to this one as its parent (..).  Note that the parent (..)
+//    of / is / itself.  It is an error if the entry already exists.
 // mkfile -
 //    Create a new empty text file with the given name.  Error if
 //    a dirent with that name exists.
+// print_dirents -
+//    Writes the listing of this directory that ls prints.
+// recur_lsr -
+//    Lists this directory and every one below it, in preorder.
+//    With more than one thread, subtrees are rendered in parallel
+//    and the output stitched back into the same order.
+// rmr -
+//    Unlinks the subdirectory named and returns it, to be freed by
+//    the reclaimer.  A plain file or missing name is left to remove,
+//    and nullptr returned.
+// link -
+//    Adds an entry, which must not exist, for a file or directory
+//    not in any other, and relinks it here under the name given.
+//    O(log n) in the entries, and O(depth) for the totals, whatever
+//    the size of what is linked.
+// unlink -
+//    Removes the entry named, which must exist, and returns what it
+//    held, leaving its links as they are.  O(log n) as link is.
+// totals -
+//    For a plain file, its size and a count of one file.  For a
+//    directory, the totals of everything below it plus itself.
+//    Kept up to date as entries come and go, so O(1).
+// add_totals -
+//    Adds a change to the totals of this directory and of every
+//    directory above it, following the parent links.
+// clone -
+//    Copies the table, so the copy shares every entry, and makes the
+//    copy the parent of the subdirectories.
+// copied_dirents -
+//    The number of entries clone has copied.
+// adopt_children -
+//    Relinks each entry to this directory under its name.  A shared
+//    node has only one parent link and name, so they are kept as the
+//    tree has them, and snapshots are relinked when restored.
 
-class directory: public base_file { // Just a map
+class directory: public base_file {
    private:
-      // Must be a map, not unordered_map, so printing is lexicographic
-      map<string,inode_ptr> dirents; 
-                                     
+      // Kept sorted, not hashed, so printing is lexicographic.
+      mutable dirent_table dirents;
+      inode* self_;         // not owned:  the inode holding this
+      subtree_totals below; // everything under this directory
+      mutable const image* image_ {nullptr}; // until loaded
+      size_t index_ {0};
       virtual const string& error_file_type() const override {
          static const string result = "directory";
          return result;
       }
-      string path; // now create a getter and sette
+      static size_t dirent_copies;
+      void load() const;
    public:
+      explicit directory (inode* self): self_ (self) { parent_ = self; }
+      directory (inode* self, const image& from, size_t index);
+      bool loaded() const { return image_ == nullptr; }
       virtual size_t size() const override;
-      virtual void remove (const string& filename) override;
-      virtual inode_ptr mkdir (const string& dirname) override;
-      virtual inode_ptr mkfile (const string& filename) override;
-      virtual map<string,inode_ptr>& get_dirents() override {
+      virtual bool is_directory() const override { return true; }
+      virtual subtree_totals totals() const override {
+         return {below.bytes, below.files, below.dirs + 1}; }
+      virtual void add_totals(const subtree_totals& delta) override;
+      virtual base_file_ptr clone (inode* self) const override;
+      void adopt_children();
+      static size_t copied_dirents() { return dirent_copies; }
+      virtual dir_view view() const override {
+         load();
+         return dir_view (dirents, self_, parent_); }
+      virtual void remove (string_view filename) override;
+      virtual inode_ptr mkdir (string_view dirname) override;
+      virtual inode_ptr mkfile (string_view filename) override;
+      virtual dirent_table& get_dirents() override {
+         load();
          return dirents; };
-      virtual string& get_path() override { return path; };
-      virtual void set_path(const string& filepath) override { 
-         this->path = filepath; };
-      virtual void print_dirents() const override;
+      using base_file::print_dirents;
+      virtual void print_dirents (ostream& out,
+                                  const string& path) const override;
       virtual string dir_tail() const override { return "/"; };
-      virtual inode_ptr& recur_get_dir(
-         wordvec& files, size_t counter) override;
-      virtual void recur_lsr() override;
-      virtual void rmr(string&) override;
-      virtual void recur_rmr() override;
+      virtual void recur_lsr (size_t threads) override;
+      virtual inode_ptr rmr(string_view) override;
+      virtual void link (string_view name,
+                         const inode_ptr& node) override;
+      virtual inode_ptr unlink (string_view name) override;
 };
 
+// walk_order, walk_tree -
+//    The traversal engine behind lsr, rmr and du.  Visits top and
+//    every directory below it, depth first in dirent order, calling
+//    visit on each one before its subdirectories (PREORDER) or after
+//    them (POSTORDER).  There is no recursion:  the directories from
+//    top down to the one being walked are kept on a stack on the
+//    heap, so the depth of a tree is limited only by memory.  Plain
+//    files are told apart with is_directory() and never visited.
+//    In PREORDER, a visit that returns false prunes the directories
+//    below the one visited.  visit may release what is below a
+//    directory in POSTORDER, but must not add or erase dirents of
+//    directories still on the stack.
+
+enum class walk_order {PREORDER, POSTORDER};
+
+template <typename visit_fn>
+void walk_tree (base_file& top, walk_order order, visit_fn&& visit) {
+   struct frame {
+      base_file* dir;
+      dirent_table::const_iterator next;
+      dirent_table::const_iterator end;
+   };
+   if (not top.is_directory()) return;
+   vector<frame> stack;
+   auto enter = [&] (base_file& dir) {
+      using result_t = decltype (visit (dir));
+      if (order == walk_order::PREORDER) {
+         if constexpr (is_same<result_t, bool>::value) {
+            if (not visit (dir)) return;
+         }else {
+            visit (dir);
+         }
+      }
+      dir_view view = dir.view();
+      stack.push_back ({&dir, view.begin(), view.end()});
+   };
+   enter (top);
+   while (not stack.empty()) {
+      frame& current = stack.back();
+      if (current.next == current.end) {
+         base_file* dir = current.dir;
+         stack.pop_back();
+         if (order == walk_order::POSTORDER) visit (*dir);
+         continue;
+      }
+      const dirent& entry = *current.next++;
+      base_file* child = entry.node->get_contents().get();
+      if (child->is_directory()) enter (*child);
+   }
+}
+
 #endif
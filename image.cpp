@@ -0,0 +1,236 @@
+// $Id: image.cpp,v 1.1 2026-10-17 17:20:05-07 - - $
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "image.h"
+
+image::image (const string& filename):
+             filename_ (filename), file_ (filename) {
+   string_view bytes = file_.text();
+   if (bytes.size() < sizeof (image_header)) corrupt();
+   header_ = reinterpret_cast<const image_header*> (bytes.data());
+   if (memcmp (header_->magic, image_header::MAGIC,
+               sizeof image_header::MAGIC) != 0) corrupt();
+   // Check sizes one at a time, so that no sum can overflow.
+   size_t left = bytes.size() - sizeof (image_header);
+   if (header_->inodes == 0
+       or header_->inodes > left / sizeof (image_inode)) corrupt();
+   left -= header_->inodes * sizeof (image_inode);
+   if (header_->dirents != header_->inodes - 1) corrupt();
+   if (header_->dirents > left / sizeof (image_dirent)) corrupt();
+   left -= header_->dirents * sizeof (image_dirent);
+   if (header_->string_bytes > left) corrupt();
+   left -= header_->string_bytes;
+   if (header_->data_bytes != left) corrupt();
+   // New inodes are numbered from next_inode_nr, so it must leave
+   // the inode table's index of pages small.
+   if (header_->next_inode_nr <= header_->inodes
+       or header_->next_inode_nr > MAX_INODE_NR) corrupt();
+   const char* next = bytes.data() + sizeof (image_header);
+   inodes_ = reinterpret_cast<const image_inode*> (next);
+   next += header_->inodes * sizeof (image_inode);
+   dirents_ = reinterpret_cast<const image_dirent*> (next);
+   next += header_->dirents * sizeof (image_dirent);
+   strings_ = next;
+   data_ = next + header_->string_bytes;
+   if (node (0).type != image_inode::DIRECTORY) corrupt();
+   DEBUGF ('m', filename << ": " << header_->inodes << " inodes, "
+           << header_->dirents << " dirents");
+}
+
+void image::corrupt() const {
+   throw runtime_error (filename_ + ": not a yshell image");
+}
+
+// node -
+//    A directory's entries come after those of every directory
+//    before it in the inode table, one for each inode after the
+//    root up to it, so first is at least its index, and its
+//    children come after it.  No tree read from an image can then
+//    have a cycle.
+
+const image_inode& image::node (size_t index) const {
+   if (index >= header_->inodes) corrupt();
+   const image_inode& record = inodes_[index];
+   if (record.nr == 0 or record.nr >= header_->next_inode_nr) {
+      corrupt();
+   }
+   uint64_t limit = 0;
+   switch (record.type) {
+      case image_inode::PLAIN:
+         limit = header_->data_bytes;
+         break;
+      case image_inode::DIRECTORY:
+         if (record.first < index) corrupt();
+         limit = header_->dirents;
+         break;
+      default:
+         corrupt();
+   }
+   if (record.first > limit or record.count > limit - record.first) {
+      corrupt();
+   }
+   return record;
+}
+
+const image_dirent* image::entries (const image_inode& dir) const {
+   const image_dirent* result = dirents_ + dir.first;
+   for (uint64_t entry = 0; entry < dir.count; ++entry) {
+      const image_dirent& dirent = result[entry];
+      if (dirent.node != dir.first + entry + 1
+          or dirent.name > header_->string_bytes
+          or dirent.name_length > header_->string_bytes - dirent.name
+          or dirent.name_length == 0) corrupt();
+      node (dirent.node);
+   }
+   return result;
+}
+
+// image_writer -
+//    The sections of an image, built in memory as the tree is walked
+//    breadth first.  The queue holds every inode in the order of the
+//    inode table, and names maps each name to its place in the
+//    string table, viewing the names in the tree itself.
+
+struct image_writer {
+   vector<inode*> queue;
+   vector<image_inode> inodes;
+   vector<image_dirent> dirents;
+   string strings;
+   string data;
+   unordered_map<string_view,uint64_t> names;
+   void add (inode* node);
+   void fill (size_t index);
+};
+
+void image_writer::add (inode* node) {
+   queue.push_back (node);
+   inodes.push_back ({node->get_inode_nr(), image_inode::PLAIN,
+                      0, 0, 0, 0, 0});
+}
+
+void image_writer::fill (size_t index) {
+   base_file& contents = *queue[index]->get_contents();
+   if (not contents.is_directory()) {
+      string_view text = contents.readfile().text();
+      inodes[index].first = data.size();
+      inodes[index].count = text.size();
+      inodes[index].bytes = contents.size();
+      data.append (text);
+      return;
+   }
+   subtree_totals totals = contents.totals();
+   image_inode& dir = inodes[index];
+   dir.type = image_inode::DIRECTORY;
+   dir.first = dirents.size();
+   dir.count = contents.view().size() - 2;
+   dir.bytes = totals.bytes;
+   dir.files = totals.files;
+   dir.dirs = totals.dirs - 1;
+   for (const auto& entry: contents.view()) {
+      // find first:  emplace would allocate a node for every name.
+      auto name = names.find (entry.name);
+      if (name == names.end()) {
+         name = names.emplace (entry.name, strings.size()).first;
+         strings.append (entry.name);
+      }
+      dirents.push_back ({name->second, entry.name.size(),
+                          queue.size()});
+      add (entry.node.get());
+   }
+}
+
+// write_all -
+//    Writes all of bytes to fd, or returns false with errno set.
+
+static bool write_all (int fd, const char* bytes, size_t size) {
+   while (size > 0) {
+      ssize_t written = write (fd, bytes, size);
+      if (written < 0 and errno == EINTR) continue;
+      if (written < 0) return false;
+      bytes += written;
+      size -= written;
+   }
+   return true;
+}
+
+// sync_directory -
+//    Syncs the directory holding filename, so that a rename into it
+//    is on disk, or returns false with errno set.
+
+static bool sync_directory (const string& filename) {
+   size_t slash = filename.rfind ('/');
+   string dir = slash == string::npos ? "."
+              : slash == 0 ? "/" : filename.substr (0, slash);
+   int fd = open (dir.c_str(), O_RDONLY | O_DIRECTORY);
+   if (fd < 0) return false;
+   bool synced = fsync (fd) == 0;
+   int error = errno;
+   close (fd);
+   errno = error;
+   return synced;
+}
+
+void image::save (inode* root, size_t next_inode_nr,
+                  uint64_t journal_seq, const string& filename) {
+   image_writer writer;
+   writer.add (root);
+   for (size_t index = 0; index < writer.queue.size(); ++index) {
+      writer.fill (index);
+   }
+   image_header header {};
+   memcpy (header.magic, image_header::MAGIC, sizeof header.magic);
+   header.next_inode_nr = next_inode_nr;
+   header.journal_seq = journal_seq;
+   header.inodes = writer.inodes.size();
+   header.dirents = writer.dirents.size();
+   header.string_bytes = writer.strings.size();
+   header.data_bytes = writer.data.size();
+   string temporary = filename + ".tmp";
+   int fd = open (temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  0666);
+   if (fd < 0) {
+      throw runtime_error (temporary + ": " + strerror (errno));
+   }
+   bool written =
+      write_all (fd, reinterpret_cast<const char*> (&header),
+                 sizeof header)
+      and write_all (fd, reinterpret_cast<const char*> (
+                     writer.inodes.data()),
+                     writer.inodes.size() * sizeof (image_inode))
+      and write_all (fd, reinterpret_cast<const char*> (
+                     writer.dirents.data()),
+                     writer.dirents.size() * sizeof (image_dirent))
+      and write_all (fd, writer.strings.data(), writer.strings.size())
+      and write_all (fd, writer.data.data(), writer.data.size())
+      and fsync (fd) == 0;
+   int error = errno;
+   if (close (fd) < 0 and written) {
+      written = false;
+      error = errno;
+   }
+   if (written and rename (temporary.c_str(), filename.c_str()) < 0) {
+      written = false;
+      error = errno;
+   }
+   if (not written) {
+      remove (temporary.c_str());
+      throw runtime_error (filename + ": " + strerror (error));
+   }
+   if (not sync_directory (filename)) {
+      throw runtime_error (filename + ": " + strerror (errno));
+   }
+   DEBUGF ('m', filename << ": " << header.inodes << " inodes, "
+           << header.dirents << " dirents");
+}
+
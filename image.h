@@ -0,0 +1,124 @@
+// $Id: image.h,v 1.1 2026-10-17 17:20:05-07 - - $
+
+// image -
+//    A tree saved to a file, in a compact binary format meant to be
+//    mapped into memory and used in place.  After the header come
+//    four sections, one after another:
+//       the inode table, one image_inode per inode, / first, each
+//          directory followed by its entries in breadth-first order;
+//       the dirent arrays, one image_dirent per entry, the entries
+//          of each directory together and in sorted order;
+//       the string table, the names of the entries, each name
+//          stored once however many entries have it;
+//       the data blocks, the text of each plain file, as cat
+//          prints it.
+//    All integers are 64 bits, in the byte order of the machine
+//    that saved the image.
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+
+// image_header -
+//    next_inode_nr is one more than the highest inode number given
+//    out, so that when the image is loaded, no number of an inode
+//    in it is given to another before it is read in.
+//    journal_seq is the sequence number of the last command in the
+//    journal whose effect the image holds.
+
+struct image_header {
+   static constexpr char MAGIC[8] {'y', 's', 'h', 'i', 'm', 'g',
+                                   '\0', '\2'};
+   char magic[8];
+   uint64_t next_inode_nr;
+   uint64_t journal_seq;
+   uint64_t inodes;
+   uint64_t dirents;
+   uint64_t string_bytes;
+   uint64_t data_bytes;
+};
+
+// image_inode -
+//    For a directory, first and count are its entries in the dirent
+//    arrays, and bytes, files, and dirs the totals of everything
+//    below it.  For a plain file, first and count are its text in
+//    the data blocks, bytes is its size, and files and dirs are 0.
+
+struct image_inode {
+   enum : uint64_t {PLAIN, DIRECTORY};
+   uint64_t nr;
+   uint64_t type;
+   uint64_t first;
+   uint64_t count;
+   int64_t bytes;
+   int64_t files;
+   int64_t dirs;
+};
+
+// image_dirent -
+//    An entry:  its name in the string table, and its inode's index
+//    in the inode table.  Since the inode table is in breadth-first
+//    order, the entry at index k of the dirent arrays is always that
+//    of inode k + 1.
+
+struct image_dirent {
+   uint64_t name;
+   uint64_t name_length;
+   uint64_t node;
+};
+
+// image ctor -
+//    Maps the file and checks that it is an image, whose sections
+//    fit in it, and whose next_inode_nr is below MAX_INODE_NR.
+//    Throws runtime_error if not.
+// node, entries, name, text -
+//    The parts of an image, by index.  entries returns a pointer to
+//    the count entries of a directory.  So that startup does not
+//    read the whole image, each inode is checked only when node
+//    reads it, and the entries of a directory, with their names,
+//    when entries does, and runtime_error thrown if any index or
+//    offset points outside its section.
+// save -
+//    Writes the tree below root to a file, through a temporary file
+//    renamed into place, so that an old image is never left half
+//    overwritten.  The file is synced before the rename, and its
+//    directory after, so that once save returns the image is on
+//    disk.  Throws runtime_error on failure.
+
+class image {
+   private:
+      static constexpr uint64_t MAX_INODE_NR {uint64_t {1} << 32};
+      string filename_;
+      mapped_file file_;
+      const image_header* header_ {nullptr};
+      const image_inode* inodes_ {nullptr};
+      const image_dirent* dirents_ {nullptr};
+      const char* strings_ {nullptr};
+      const char* data_ {nullptr};
+      [[noreturn]] void corrupt() const;
+   public:
+      explicit image (const string& filename);
+      image (const image&) = delete;
+      image& operator= (const image&) = delete;
+      const image_header& header() const { return *header_; }
+      const image_inode& node (size_t index) const;
+      const image_dirent* entries (const image_inode& dir) const;
+      string_view name (const image_dirent& entry) const {
+         return {strings_ + entry.name, entry.name_length};
+      }
+      string_view text (const image_inode& file) const {
+         return {data_ + file.first, file.count};
+      }
+      static void save (inode* root, size_t next_inode_nr,
+                        uint64_t journal_seq, const string& filename);
+};
+
+#endif
+
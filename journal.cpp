@@ -0,0 +1,162 @@
+// $Id: journal.cpp,v 1.1 2026-10-17 18:10:37-07 - - $
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "journal.h"
+
+// record_header -
+//    What comes before the payload of each record.
+
+struct record_header {
+   uint32_t length;
+   uint32_t checksum;
+   uint64_t seq;
+};
+
+// checksum -
+//    FNV-1a over the sequence number and payload of a record.
+
+static uint32_t checksum (uint64_t seq, string_view payload) {
+   uint32_t hash = 2166136261u;
+   auto mix = [&hash] (const char* bytes, size_t size) {
+      for (size_t index = 0; index < size; ++index) {
+         hash = (hash ^ static_cast<unsigned char> (bytes[index]))
+              * 16777619u;
+      }
+   };
+   mix (reinterpret_cast<const char*> (&seq), sizeof seq);
+   mix (payload.data(), payload.size());
+   return hash;
+}
+
+// get_u32 -
+//    Takes a 32-bit length off the front of bytes, or returns false
+//    if there is not one there.
+
+static bool get_u32 (string_view& bytes, uint32_t& value) {
+   if (bytes.size() < sizeof value) return false;
+   memcpy (&value, bytes.data(), sizeof value);
+   bytes.remove_prefix (sizeof value);
+   return true;
+}
+
+static void put_u32 (string& bytes, uint32_t value) {
+   bytes.append (reinterpret_cast<const char*> (&value), sizeof value);
+}
+
+journal::journal (const string& filename, size_t batch):
+         filename_ (filename), batch_ (batch == 0 ? 1 : batch) {
+   fd_ = open (filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+   if (fd_ < 0) {
+      throw runtime_error (filename + ": " + strerror (errno));
+   }
+   bytes_ = lseek (fd_, 0, SEEK_END);
+}
+
+journal::~journal() {
+   if (unsynced_ > 0) fdatasync (fd_);
+   close (fd_);
+}
+
+size_t journal::replay (const visit_fn& visit) {
+   mapped_file file (filename_);
+   string_view bytes = file.text();
+   size_t records = 0;
+   size_t intact = 0;
+   while (bytes.size() >= sizeof (record_header)) {
+      record_header header;
+      memcpy (&header, bytes.data(), sizeof header);
+      string_view payload = bytes.substr (sizeof header);
+      if (header.length > payload.size()) break;
+      payload = payload.substr (0, header.length);
+      if (checksum (header.seq, payload) != header.checksum) break;
+      uint32_t count = 0;
+      if (not get_u32 (payload, count)) break;
+      words_.clear();
+      for (; count > 0; --count) {
+         uint32_t length = 0;
+         if (not get_u32 (payload, length)
+             or length > payload.size()) break;
+         words_.push_back (payload.substr (0, length));
+         payload.remove_prefix (length);
+      }
+      if (count > 0 or words_.empty() or not payload.empty()) break;
+      visit (header.seq, words_);
+      ++records;
+      bytes.remove_prefix (sizeof header + header.length);
+      intact += sizeof header + header.length;
+   }
+   if (intact < file.text().size()) {
+      DEBUGF ('j', filename_ << ": cut at " << intact << " of "
+              << file.text().size() << " bytes");
+      truncate (intact);
+   }
+   DEBUGF ('j', filename_ << ": " << records << " records");
+   return records;
+}
+
+void journal::append (uint64_t seq, const wordviews& words) {
+   record_.assign (sizeof (record_header), '\0');
+   put_u32 (record_, words.size());
+   for (string_view word: words) {
+      put_u32 (record_, word.size());
+      record_.append (word);
+   }
+   string_view payload = string_view (record_)
+                         .substr (sizeof (record_header));
+   record_header header {static_cast<uint32_t> (payload.size()),
+                         checksum (seq, payload), seq};
+   memcpy (record_.data(), &header, sizeof header);
+   const char* next = record_.data();
+   size_t left = record_.size();
+   while (left > 0) {
+      ssize_t written = write (fd_, next, left);
+      if (written < 0 and errno == EINTR) continue;
+      if (written < 0) {
+         int error = errno;
+         // Take back a partial record, so the next one is readable,
+         // but report why the write failed, not the truncate.
+         if (ftruncate (fd_, bytes_) < 0) {
+            DEBUGF ('j', filename_ << ": cannot take back record: "
+                    << strerror (errno));
+         }
+         throw runtime_error (filename_ + ": " + strerror (error));
+      }
+      next += written;
+      left -= written;
+   }
+   bytes_ += record_.size();
+   if (++unsynced_ >= batch_) sync();
+}
+
+void journal::sync() {
+   if (unsynced_ == 0) return;
+   if (fdatasync (fd_) < 0) {
+      throw runtime_error (filename_ + ": " + strerror (errno));
+   }
+   DEBUGF ('j', filename_ << ": synced " << unsynced_ << " records");
+   unsynced_ = 0;
+}
+
+void journal::clear() {
+   truncate (0);
+   unsynced_ = 0;
+   if (fdatasync (fd_) < 0) {
+      throw runtime_error (filename_ + ": " + strerror (errno));
+   }
+}
+
+void journal::truncate (size_t bytes) {
+   if (ftruncate (fd_, bytes) < 0) {
+      throw runtime_error (filename_ + ": " + strerror (errno));
+   }
+   bytes_ = bytes;
+}
+
@@ -0,0 +1,81 @@
+// $Id: journal.h,v 1.1 2026-10-17 18:10:37-07 - - $
+
+// journal -
+//    An append-only log of the commands that change the tree, from
+//    which a session is rebuilt after a crash.  Each command is one
+//    record:
+//       a header of its payload length, a checksum, and a sequence
+//          number, one more than that of the record before;
+//       the payload, the number of words, then each word as its
+//          length and bytes.
+//    Lengths are 32 bits, sequence numbers 64, in the byte order of
+//    the machine.  Records are written to the file as they come, so
+//    that one outlives a crash of the shell at once, but only synced
+//    to disk once every batch records, so that many commands share
+//    the cost of one fdatasync (group commit).  The shell also syncs
+//    whenever it waits for input, so that a record is held back only
+//    while more commands keep coming.  A crash of the whole system
+//    can lose the records of at most one batch, all of whose
+//    commands ran back to back.
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+using namespace std;
+
+#include "util.h"
+
+// journal ctor -
+//    Opens the journal file, creating it if need be, to append to.
+//    Throws runtime_error if it can not be opened.
+// dtor -
+//    Syncs whatever has not been.
+// replay -
+//    Calls visit with the sequence number and words of each intact
+//    record in order.  The file is cut off at the first record that
+//    is not, which a crash left half written.  Returns the number
+//    of records visited.
+// append -
+//    Writes a record, and syncs if that completes a batch.  Throws
+//    runtime_error if the record can not be written.
+// sync -
+//    Syncs the records written so far to disk.
+// clear -
+//    Empties the journal, once what it holds is saved elsewhere.
+//    Throws runtime_error if it can not be truncated or synced.
+// bytes -
+//    The size of the journal file.
+
+class journal {
+   public:
+      using visit_fn = function<void (uint64_t seq,
+                                      const wordviews& words)>;
+      static constexpr size_t DEFAULT_BATCH {32};
+      static constexpr size_t COMPACT_BYTES {64 << 20};
+   private:
+      string filename_;
+      int fd_ {-1};
+      size_t batch_;
+      size_t unsynced_ {0};
+      size_t bytes_ {0};
+      string record_;       // reused to encode each record
+      wordviews words_;     // reused to decode each record
+      void truncate (size_t bytes);
+   public:
+      journal (const string& filename, size_t batch);
+      ~journal();
+      journal (const journal&) = delete;
+      journal& operator= (const journal&) = delete;
+      const string& filename() const { return filename_; }
+      size_t bytes() const { return bytes_; }
+      size_t replay (const visit_fn& visit);
+      void append (uint64_t seq, const wordviews& words);
+      void sync();
+      void clear();
+};
+
+#endif
+
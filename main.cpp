@@ -1,9 +1,14 @@
 // $Id: main.cpp,v 1.10 2019-10-08 13:55:31-07 - - $
 
+#include <charconv>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <utility>
+#include <poll.h>
 #include <unistd.h>
 
 using namespace std;
@@ -11,20 +16,85 @@ using namespace std;
 #include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
+#include "output.h"
 #include "util.h"
 
+// options -
+//    -@flags  sets debug flags.
+//    -f file  runs the script in file in batch mode instead of
+//             reading commands from cin.
+//    -e       echoes the prompt and each line in batch mode, which
+//             is otherwise silent except for command output.
+//    -i image starts from the tree saved in image, instead of an
+//             empty root.
+//    -j file  logs commands that change the tree to the journal
+//             file, first replaying what it holds on top of the
+//             image it was compacted into, if there is one, or else
+//             the one given by -i.
+//    -g batch syncs the journal once every batch commands, and
+//             whenever the shell waits for input.
+//    -s file  writes the metrics stats shows to file as JSON at
+//             exit, or to stderr if file is -.
+//    -T file  writes the trace of the debug flags set to file,
+//             instead of to yshell.trace.
+
+struct options {
+   string image;
+   string journal;
+   size_t batch {journal::DEFAULT_BATCH};
+   string script;
+   string stats;
+   string trace;
+   bool echo {false};
+};
+
+// batch_size -
+//    The operand of -g, or the default if it is not a number.
+
+size_t batch_size (string_view arg) {
+   size_t batch = 0;
+   auto [end, error] = from_chars (arg.data(), arg.data() + arg.size(),
+                                   batch);
+   if (error == errc() and end == arg.data() + arg.size()
+       and batch > 0) return batch;
+   complain() << "-g " << arg << ": invalid batch size" << endl;
+   return journal::DEFAULT_BATCH;
+}
+
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis.
 
-void scan_options (int argc, char** argv) {
+options scan_options (int argc, char** argv) {
+   options result;
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:ef:g:i:j:s:T:");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'e':
+            result.echo = true;
+            break;
+         case 'f':
+            result.script = optarg;
+            break;
+         case 'g':
+            result.batch = batch_size (optarg);
+            break;
+         case 'i':
+            result.image = optarg;
+            break;
+         case 'j':
+            result.journal = optarg;
+            break;
+         case 's':
+            result.stats = optarg;
+            break;
+         case 'T':
+            result.trace = optarg;
+            break;
          default:
             complain() << "-" << static_cast<char> (option)
                        << ": invalid option" << endl;
@@ -34,54 +104,159 @@ void scan_options (int argc, char** argv) {
    if (optind < argc) {
       complain() << "operands not permitted" << endl;
    }
+   if (result.trace.empty() and debugflags::any()) {
+      result.trace = exec::execname() + ".trace";
+   }
+   return result;
+}
+
+// report_throughput -
+//    Prints how many lines a batch ran, and how fast.
+
+void report_throughput (size_t lines,
+                        chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed = chrono::steady_clock::now()
+                                    - start;
+   cerr << exec::execname() << ": " << lines << " lines in "
+        << elapsed.count() << " s, " << lines / elapsed.count()
+        << " lines/s" << endl;
+}
+
+// run_batch -
+//    Maps the script into memory, then splits and runs each line in
+//    place, back to back, without copying it.  Reports the number of
+//    lines per second to cerr at the end, even if the script exits.
+
+void run_batch (inode_state& state, const options& opts) {
+   mapped_file script (opts.script);
+   string_view text = script.text();
+   tokenizer tokens;
+   size_t lines = 0;
+   auto start = chrono::steady_clock::now();
+   try {
+      while (not text.empty()) {
+         size_t newline = text.find ('\n');
+         string_view line = text.substr (0, newline);
+         text.remove_prefix (newline == string_view::npos
+                             ? text.size() : newline + 1);
+         ++lines;
+         if (opts.echo) cout << state.prompt() << line << '\n';
+         run_command (state, tokens.split (line, " \t\r"));
+      }
+   } catch (ysh_exit&) {
+      report_throughput (lines, start);
+      throw;
+   }
+   report_throughput (lines, start);
+}
+
+
+// start_journal -
+//    Loads the image the journal was compacted into, if any, replays
+//    the journal, and starts logging to it.
+
+void start_journal (inode_state& state, const options& opts,
+                    optional<journal>& log) {
+   log.emplace (opts.journal, opts.batch);
+   string image = journal_image (*log);
+   if (access (image.c_str(), F_OK) == 0) state.load_image (image);
+   else if (not opts.image.empty()) state.load_image (opts.image);
+   size_t replayed = replay_journal (state, *log);
+   if (replayed > 0) {
+      cerr << exec::execname() << ": " << opts.journal << ": "
+           << replayed << " commands replayed" << endl;
+   }
+   state.set_journal (&*log);
+}
+
+// sync_when_idle -
+//    Syncs the journal if no input is waiting, since the shell is
+//    about to block for more.  Group commit then holds records back
+//    only while commands keep coming, never while the shell is idle.
+
+void sync_when_idle (journal& log) {
+   if (cin.rdbuf()->in_avail() > 0) return;
+   pollfd input {STDIN_FILENO, POLLIN, 0};
+   if (poll (&input, 1, 0) > 0) return;
+   try {
+      log.sync();
+   }catch (runtime_error& error) {
+      complain() << error.what() << endl;
+   }
+}
+
+// write_stats -
+//    Writes the metrics as JSON to the file named, or to cerr.
+
+void write_stats (inode_state& state, const string& filename) {
+   if (filename == "-") {
+      print_stats_json (state, cerr);
+      return;
+   }
+   ofstream out (filename);
+   print_stats_json (state, out);
+   out.close();
+   if (not out) {
+      complain() << filename << ": cannot write stats" << endl;
+   }
 }
 
-
 // main -
 //    Main program which loops reading commands until end of file.
 
 int main (int argc, char** argv) {
    exec::execname (argv[0]);
+   output_sink sink (STDOUT_FILENO);
+   streambuf* stdout_buf = cout.rdbuf (&sink);
+   // Reading cin flushes cout only if someone is typing at it.
+   if (not isatty (STDIN_FILENO)) cin.tie (nullptr);
    cout << boolalpha;  // Print false or true instead of 0 or 1.
    cerr << boolalpha;
    cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
-   scan_options (argc, argv);
+   options opts = scan_options (argc, argv);
    bool need_echo = want_echo();
    inode_state state;
+   optional<journal> log;
+   string line;       // Reused, so the words below can view it.
+   tokenizer tokens;
    try {
+      if (not opts.trace.empty()) trace::start (opts.trace);
+      if (not opts.journal.empty()) start_journal (state, opts, log);
+      else if (not opts.image.empty()) state.load_image (opts.image);
+      if (not opts.script.empty()) {
+         run_batch (state, opts);
+         throw ysh_exit();
+      }
       for (;;) {
-         try {
-            // Read a line, break at EOF, and echo print the prompt
-            // if one is needed.
-            cout << state.prompt();
-            string line;
-            getline (cin, line);
-            if (cin.eof()) {
-               if (need_echo) cout << "^D";
-               cout << endl;
-               DEBUGF ('y', "EOF");
-               break;
-            }
-            if (need_echo) cout << line << endl;
-   
-            // Split the line into words and lookup the appropriate
-            // function.  Complain or call it.
-            wordvec words = split (line, " \t");
-            DEBUGF ('y', "words = " << words);
-            command_fn fn = find_command_fn (words.at(0));
-            fn (state, words);
-         }catch (command_error& error) {
-            // If there is a problem discovered in any function, an
-            // exn is thrown and printed here.
-            complain() << error.what() << endl;
-         }catch (file_error& error) {
-            complain() << error.what() << endl;
+         // Read a line, break at EOF, and echo print the prompt
+         // if one is needed.
+         if (log) sync_when_idle (*log);
+         cout << state.prompt();
+         getline (cin, line);
+         if (cin.eof()) {
+            if (need_echo) cout << "^D";
+            cout << '\n';
+            DEBUGF ('y', "EOF");
+            break;
          }
+         if (need_echo) cout << line << '\n';
+
+         // Split the line into words and lookup the appropriate
+         // function.  Complain or call it.
+         const wordviews& words = tokens.split (line, " \t");
+         DEBUGF ('y', "words = " << words);
+         run_command (state, words);
       }
    } catch (ysh_exit&) {
       // This catch intentionally left blank.
+   } catch (runtime_error& error) {
+      // The trace, image, journal, or batch script could not be
+      // opened.
+      complain() << error.what() << endl;
    }
 
-   return exit_status_message();
+   int status = exit_status_message();
+   if (not opts.stats.empty()) write_stats (state, opts.stats);
+   cout.rdbuf (stdout_buf);
+   return status;
 }
-
@@ -0,0 +1,42 @@
+// $Id: metrics.cpp,v 1.1 2026-10-17 19:40:27-07 - - $
+
+#include <cmath>
+
+using namespace std;
+
+#include "metrics.h"
+
+uint64_t latency_histogram::percentile (double fraction) const {
+   if (count_ == 0) return 0;
+   // The rank of the latency wanted, counting from 1.
+   uint64_t rank = ceil (fraction * count_);
+   if (rank == 0) rank = 1;
+   uint64_t seen = 0;
+   for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+      seen += buckets_[bucket];
+      if (seen >= rank) {
+         return bucket == 0 ? 0 : (uint64_t (1) << bucket) - 1;
+      }
+   }
+   return (uint64_t (1) << (BUCKETS - 1)) - 1;
+}
+
+void latency_histogram::print_json (ostream& out) const {
+   size_t last = BUCKETS;
+   while (last > 0 and buckets_[last - 1] == 0) --last;
+   out << "[";
+   for (size_t bucket = 0; bucket < last; ++bucket) {
+      if (bucket > 0) out << ",";
+      out << buckets_[bucket];
+   }
+   out << "]";
+}
+
+command_timer::~command_timer() {
+   auto nanos = chrono::duration_cast<chrono::nanoseconds> (
+                chrono::steady_clock::now() - start_).count();
+   ++metrics_.calls;
+   if (failed_) ++metrics_.errors;
+   metrics_.latency.add (nanos);
+}
+
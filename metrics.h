@@ -0,0 +1,87 @@
+// $Id: metrics.h,v 1.1 2026-10-17 19:40:27-07 - - $
+
+// metrics -
+//    What the shell measures about the commands it runs, for the
+//    stats command:  how often each is called, how often it fails,
+//    and how long it takes.
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+using namespace std;
+
+// latency_histogram -
+//    Latencies in nanoseconds, counted in buckets by powers of two:
+//    bucket 0 holds 0 ns, and bucket b the latencies from 2^(b-1)
+//    to 2^b - 1 ns, so that adding one is a count of leading zeros
+//    and an increment, and the whole histogram fits in a few cache
+//    lines.  The last bucket holds everything from about 2^46 ns,
+//    nearly a day.
+// add -
+//    Counts one latency.
+// count -
+//    The number of latencies counted.
+// percentile -
+//    An upper bound on the latency under which the fraction given
+//    of those counted fall:  the top of its bucket, so within a
+//    factor of two.  0 if there are none.
+// print_json -
+//    Writes the counts of the buckets as a JSON array, from the
+//    first to the last that is not empty.
+
+class latency_histogram {
+   public:
+      static constexpr size_t BUCKETS {48};
+   private:
+      uint64_t buckets_[BUCKETS] {};
+      uint64_t count_ {0};
+   public:
+      static size_t bucket (uint64_t nanos) {
+         size_t bits = nanos == 0 ? 0 : 64 - __builtin_clzll (nanos);
+         return bits < BUCKETS ? bits : BUCKETS - 1;
+      }
+      void add (uint64_t nanos) {
+         ++buckets_[bucket (nanos)];
+         ++count_;
+      }
+      uint64_t count() const { return count_; }
+      uint64_t percentile (double fraction) const;
+      void print_json (ostream& out) const;
+};
+
+// command_metrics -
+//    What is kept for each command.  calls counts every line that
+//    names it, and errors those that were rejected or that threw.
+
+struct command_metrics {
+   uint64_t calls {0};
+   uint64_t errors {0};
+   latency_histogram latency;
+};
+
+// command_timer -
+//    Times a command from its construction to its destruction, and
+//    counts it then in the metrics given, as an error if failed()
+//    was called.  So a command that ends by throwing, as exit does,
+//    is still counted.
+
+class command_timer {
+   private:
+      command_metrics& metrics_;
+      chrono::steady_clock::time_point start_;
+      bool failed_ {false};
+   public:
+      explicit command_timer (command_metrics& metrics):
+               metrics_ (metrics),
+               start_ (chrono::steady_clock::now()) {}
+      ~command_timer();
+      command_timer (const command_timer&) = delete;
+      command_timer& operator= (const command_timer&) = delete;
+      void failed() { failed_ = true; }
+};
+
+#endif
+
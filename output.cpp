@@ -0,0 +1,92 @@
+// $Id: output.cpp,v 1.1 2026-10-17 14:20:51-07 - - $
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "output.h"
+
+output_sink::output_sink (int fd):
+             fd_ (fd), is_tty_ (isatty (fd)), buffer_ (BUFFER_SIZE) {
+   setp (buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+output_sink::~output_sink() {
+   drain();
+}
+
+// drain -
+//    Writes out everything buffered, retrying short writes.
+
+bool output_sink::drain() {
+   const char* data = pbase();
+   size_t count = pptr() - pbase();
+   while (count > 0) {
+      ssize_t written = write (fd_, data, count);
+      if (written < 0) {
+         if (errno == EINTR) continue;
+         setp (buffer_.data(), buffer_.data() + buffer_.size());
+         return false;
+      }
+      data += written;
+      count -= written;
+   }
+   setp (buffer_.data(), buffer_.data() + buffer_.size());
+   return true;
+}
+
+output_sink::int_type output_sink::overflow (int_type ch) {
+   if (not drain()) return traits_type::eof();
+   if (not traits_type::eq_int_type (ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type (ch);
+      pbump (1);
+   }
+   return traits_type::not_eof (ch);
+}
+
+streamsize output_sink::xsputn (const char* data, streamsize count) {
+   streamsize done = 0;
+   while (done < count) {
+      streamsize room = epptr() - pptr();
+      if (room == 0) {
+         if (not drain()) break;
+         continue;
+      }
+      streamsize chunk = min (room, count - done);
+      memcpy (pptr(), data + done, chunk);
+      pbump (chunk);
+      done += chunk;
+   }
+   return done;
+}
+
+int output_sink::sync() {
+   return drain() ? 0 : -1;
+}
+
+void put_right (ostream& out, uint64_t value, int width) {
+   char digits[24];
+   char* end = digits + sizeof digits;
+   char* begin = end;
+   do {
+      *--begin = static_cast<char> ('0' + value % 10);
+      value /= 10;
+   }while (value != 0);
+   static const char spaces[] = "                        ";
+   int padding = width - (end - begin);
+   while (padding > 0) {
+      int chunk = min<int> (padding, sizeof spaces - 1);
+      out.write (spaces, chunk);
+      padding -= chunk;
+   }
+   out.write (begin, end - begin);
+}
+
+void end_of_command (ostream& out) {
+   auto sink = dynamic_cast<output_sink*> (out.rdbuf());
+   if (sink != nullptr and sink->is_tty()) out.flush();
+}
+
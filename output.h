@@ -0,0 +1,65 @@
+// $Id: output.h,v 1.1 2026-10-17 14:20:51-07 - - $
+
+// output -
+//    The output engine behind cout.  Everything the shell prints
+//    goes through one large reusable buffer which is written out
+//    only at explicit flush points, rather than being pushed out
+//    by every endl:
+//    - when the buffer is full,
+//    - when cout is flushed, which complain() does before writing
+//      to cerr, so stdout and stderr stay in order,
+//    - after each command, if stdout is a terminal, and
+//    - when cin is about to be read, through cin.tie(), if stdin
+//      is a terminal.
+//    Commands that print a lot should end lines with '\n', not
+//    endl, and use put_right for numeric columns.
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <cstdint>
+#include <iostream>
+#include <streambuf>
+#include <vector>
+using namespace std;
+
+// output_sink -
+//    A streambuf which writes to a file descriptor in blocks of
+//    BUFFER_SIZE bytes.  Install it with cout.rdbuf (&sink), and
+//    put the old streambuf back before the sink is destroyed.
+
+class output_sink: public streambuf {
+   public:
+      static constexpr size_t BUFFER_SIZE {1 << 20};
+      explicit output_sink (int fd);
+      ~output_sink();
+      output_sink (const output_sink&) = delete;
+      output_sink& operator= (const output_sink&) = delete;
+      bool is_tty() const { return is_tty_; }
+   protected:
+      virtual int_type overflow (int_type ch) override;
+      virtual streamsize xsputn (const char* data,
+                                 streamsize count) override;
+      virtual int sync() override;
+   private:
+      int fd_;
+      bool is_tty_;
+      vector<char> buffer_;
+      bool drain();
+};
+
+// put_right -
+//    Writes an unsigned number right justified in a field of the
+//    given width, exactly as out << setw (width) << value would,
+//    but without going through the locale.
+
+void put_right (ostream& out, uint64_t value, int width);
+
+// end_of_command -
+//    Flush point after each command:  flushes out if it is an
+//    output_sink attached to a terminal.
+
+void end_of_command (ostream& out);
+
+#endif
+
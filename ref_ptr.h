@@ -0,0 +1,106 @@
+// $Id: ref_ptr.h,v 1.1 2026-10-17 16:05:44-07 - - $
+
+// ref_ptr -
+//    Intrusive reference counting for the nodes of the file system.
+//    The count lives in the object itself, so there is no separate
+//    control block, and a handle is one pointer wide.  The count is
+//    a plain integer:  a tree is only ever touched by one thread at
+//    a time, the reclaimer being given subtrees nothing else refers
+//    to, and the workers of lsr -j reading through raw pointers.
+//    Compiling with -DREFCOUNT_ATOMIC makes the count atomic, for a
+//    build in which handles are shared between threads.
+
+#ifndef __REF_PTR_H__
+#define __REF_PTR_H__
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <utility>
+using namespace std;
+
+// ref_counted -
+//    Base class of anything held by ref_ptr.  The object deletes
+//    itself through the static type of the last ref_ptr to let go,
+//    so a polymorphic base needs a virtual destructor.
+
+class ref_counted {
+   template <typename> friend class ref_ptr;
+   private:
+#ifdef REFCOUNT_ATOMIC
+      mutable atomic<size_t> refs_ {0};
+#else
+      mutable size_t refs_ {0};
+#endif
+   protected:
+      ref_counted() = default;
+      ~ref_counted() = default;
+   public:
+      ref_counted (const ref_counted&) = delete;
+      ref_counted& operator= (const ref_counted&) = delete;
+};
+
+// ref_ptr -
+//    A counted handle, used like shared_ptr.  Constructing one from
+//    a raw pointer adds a reference, so a handle can be made from a
+//    borrowed pointer at any time.
+// unique -
+//    Whether this is the only handle to the object.
+// make_ref -
+//    Like make_shared.
+
+template <typename item_t>
+class ref_ptr {
+   template <typename> friend class ref_ptr;
+   private:
+      item_t* ptr_ {nullptr};
+      void acquire() const { if (ptr_ != nullptr) ++ptr_->refs_; }
+      void release() const {
+         if (ptr_ != nullptr and --ptr_->refs_ == 0) delete ptr_;
+      }
+   public:
+      ref_ptr() = default;
+      ref_ptr (nullptr_t) {}
+      explicit ref_ptr (item_t* ptr): ptr_ (ptr) { acquire(); }
+      ref_ptr (const ref_ptr& that): ptr_ (that.ptr_) { acquire(); }
+      ref_ptr (ref_ptr&& that) noexcept: ptr_ (that.ptr_) {
+         that.ptr_ = nullptr;
+      }
+      template <typename other_t>
+      ref_ptr (ref_ptr<other_t>&& that) noexcept: ptr_ (that.ptr_) {
+         that.ptr_ = nullptr;
+      }
+      ~ref_ptr() { release(); }
+      ref_ptr& operator= (ref_ptr that) noexcept {
+         swap (ptr_, that.ptr_);
+         return *this;
+      }
+      item_t* get() const { return ptr_; }
+      item_t& operator*() const { return *ptr_; }
+      item_t* operator->() const { return ptr_; }
+      explicit operator bool() const { return ptr_ != nullptr; }
+      bool unique() const {
+         return ptr_ != nullptr and ptr_->refs_ == 1;
+      }
+      bool operator== (const ref_ptr& that) const {
+         return ptr_ == that.ptr_;
+      }
+      bool operator!= (const ref_ptr& that) const {
+         return ptr_ != that.ptr_;
+      }
+      bool operator== (nullptr_t) const { return ptr_ == nullptr; }
+      bool operator!= (nullptr_t) const { return ptr_ != nullptr; }
+};
+
+template <typename item_t, typename... args_t>
+ref_ptr<item_t> make_ref (args_t&&... args) {
+   return ref_ptr<item_t> (new item_t (forward<args_t> (args)...));
+}
+
+template <typename item_t>
+ostream& operator<< (ostream& out, const ref_ptr<item_t>& ptr) {
+   return out << static_cast<const void*> (ptr.get());
+}
+
+#endif
+
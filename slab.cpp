@@ -0,0 +1,90 @@
+// $Id: slab.cpp,v 1.1 2026-10-17 09:12:40-07 - - $
+
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+#include "debug.h"
+#include "slab.h"
+
+slab_arena::chunk* slab_arena::free_lists_[NCLASSES] {};
+size_t slab_arena::in_use_ {0};
+size_t slab_arena::reserved_ {0};
+atomic_flag slab_arena::busy_ = ATOMIC_FLAG_INIT;
+
+// lock -
+//    Holds busy_ for as long as it lives.
+
+class slab_arena::lock {
+   public:
+      lock() {
+         while (busy_.test_and_set (memory_order_acquire)) {
+            this_thread::yield();
+         }
+      }
+      ~lock() { busy_.clear (memory_order_release); }
+      lock (const lock&) = delete;
+      lock& operator= (const lock&) = delete;
+};
+
+#ifndef SLAB_DISABLED
+// class_of -
+//    Size class of a request:  0 for 1..16 bytes, 1 for 17..32,
+//    and so on.
+
+static size_t class_of (size_t bytes) {
+   return (bytes + slab_arena::GRANULE - 1) / slab_arena::GRANULE - 1;
+}
+#endif
+
+void slab_arena::refill (size_t class_nr) {
+   size_t chunk_bytes = (class_nr + 1) * GRANULE;
+   char* slab = static_cast<char*> (::operator new (SLAB_BYTES));
+   reserved_ += SLAB_BYTES;
+   // Thread the chunks onto the free list back to front so that
+   // they are handed out in address order.
+   size_t count = SLAB_BYTES / chunk_bytes;
+   for (size_t itor = count; itor > 0; --itor) {
+      chunk* free = reinterpret_cast<chunk*> (
+                    slab + (itor - 1) * chunk_bytes);
+      free->next = free_lists_[class_nr];
+      free_lists_[class_nr] = free;
+   }
+   DEBUGF ('s', "class " << class_nr << ": " << count << " chunks");
+}
+
+void* slab_arena::allocate (size_t bytes) {
+#ifdef SLAB_DISABLED
+   return ::operator new (bytes);
+#else
+   if (bytes == 0 or bytes > MAX_SMALL) return ::operator new (bytes);
+   size_t class_nr = class_of (bytes);
+   lock guard;
+   if (free_lists_[class_nr] == nullptr) refill (class_nr);
+   chunk* result = free_lists_[class_nr];
+   free_lists_[class_nr] = result->next;
+   in_use_ += (class_nr + 1) * GRANULE;
+   return result;
+#endif
+}
+
+void slab_arena::deallocate (void* ptr, size_t bytes) noexcept {
+#ifdef SLAB_DISABLED
+   static_cast<void> (bytes);
+   ::operator delete (ptr);
+#else
+   if (bytes == 0 or bytes > MAX_SMALL) {
+      ::operator delete (ptr);
+      return;
+   }
+   size_t class_nr = class_of (bytes);
+   chunk* freed = static_cast<chunk*> (ptr);
+   lock guard;
+   freed->next = free_lists_[class_nr];
+   free_lists_[class_nr] = freed;
+   in_use_ -= (class_nr + 1) * GRANULE;
+#endif
+}
+
@@ -0,0 +1,107 @@
+// $Id: slab.h,v 1.1 2026-10-17 09:12:40-07 - - $
+
+// slab -
+//    A size-classed slab allocator for the small, uniformly sized
+//    objects the file system churns through:  inodes, their
+//    base_file payloads, and the nodes of the dirent tables.
+//    Requests are rounded up to a multiple of GRANULE bytes and
+//    served from a per-class free list which is refilled a whole
+//    slab at a time, so building a tree of millions of nodes costs
+//    one malloc per SLAB_BYTES instead of several per node.
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+using namespace std;
+
+// slab_arena -
+//    Static class holding one free list per size class.
+// allocate -
+//    Returns a chunk of at least the given size.  Requests larger
+//    than MAX_SMALL fall through to ::operator new.
+// deallocate -
+//    Returns a chunk to its free list.  The size must be the same
+//    as was passed to allocate.  Slabs are never given back to the
+//    system; a freed chunk is reused by the next allocation of the
+//    same class.
+// bytes_in_use, bytes_reserved -
+//    Statistics for the benchmarks:  bytes handed out and not yet
+//    returned, and bytes obtained from the system for slabs.
+//
+// The reclaimer frees nodes on a thread of its own, so allocate and
+// deallocate hold a spin lock while they touch the free lists.  It
+// is almost never contended, and then costs one atomic exchange.
+//
+// Compiling with -DSLAB_DISABLED routes everything to ::operator
+// new, which is how the benchmarks measure the plain heap.
+
+class slab_arena {
+   public:
+      static constexpr size_t GRANULE {16};
+      static constexpr size_t MAX_SMALL {512};
+      static constexpr size_t SLAB_BYTES {64 * 1024};
+      static void* allocate (size_t bytes);
+      static void deallocate (void* ptr, size_t bytes) noexcept;
+      static size_t bytes_in_use() { return in_use_; }
+      static size_t bytes_reserved() { return reserved_; }
+   private:
+      static constexpr size_t NCLASSES {MAX_SMALL / GRANULE};
+      struct chunk { chunk* next; };
+      class lock;
+      static atomic_flag busy_;
+      static chunk* free_lists_[NCLASSES];
+      static size_t in_use_;
+      static size_t reserved_;
+      static void refill (size_t class_nr);
+};
+
+// slab_allocator -
+//    Standard allocator adapter over slab_arena, so that containers
+//    can place their nodes in the slabs.  Any request of up to
+//    MAX_SMALL bytes, an array as well as a single node, is served
+//    from the slabs; larger ones go to the heap.
+
+template <typename item_t>
+struct slab_allocator {
+   using value_type = item_t;
+   slab_allocator() = default;
+   template <typename other_t>
+   slab_allocator (const slab_allocator<other_t>&) {}
+   item_t* allocate (size_t count) {
+      return static_cast<item_t*> (
+             slab_arena::allocate (count * sizeof (item_t)));
+   }
+   void deallocate (item_t* ptr, size_t count) noexcept {
+      slab_arena::deallocate (ptr, count * sizeof (item_t));
+   }
+};
+
+template <typename left_t, typename right_t>
+bool operator== (const slab_allocator<left_t>&,
+                 const slab_allocator<right_t>&) { return true; }
+template <typename left_t, typename right_t>
+bool operator!= (const slab_allocator<left_t>&,
+                 const slab_allocator<right_t>&) { return false; }
+
+// slab_object -
+//    Base class whose operator new and delete place objects of the
+//    classes derived from it in the slabs.  A polymorphic class is
+//    deleted through its virtual destructor, which passes the size
+//    of the most derived class to the sized operator delete.
+
+class slab_object {
+   public:
+      static void* operator new (size_t bytes) {
+         return slab_arena::allocate (bytes);
+      }
+      static void operator delete (void* ptr, size_t bytes) noexcept {
+         slab_arena::deallocate (ptr, bytes);
+      }
+};
+
+#endif
+
@@ -1,7 +1,16 @@
 // $Id: util.cpp,v 1.14 2019-10-08 14:01:38-07 - - $
 
+#include <cerrno>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#if defined (__AVX2__) || defined (__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -37,24 +46,104 @@ void exec::status (int status) {
 }
 
 
-wordvec split (const string& line, const string& delimiters) {
-   wordvec words;
+// find_delimiter -
+//    Index of the first char at or after pos which is (if wanted is
+//    true) or is not (if false) one of the delimiters, or the length
+//    of the text if there is none.
+
+static size_t find_delimiter (string_view text, size_t pos,
+                              string_view delimiters, bool wanted) {
+#ifdef __AVX2__
+   while (pos + 32 <= text.size()) {
+      __m256i block = _mm256_loadu_si256 (
+            reinterpret_cast<const __m256i*> (text.data() + pos));
+      __m256i hits = _mm256_setzero_si256();
+      for (char delimiter: delimiters) {
+         hits = _mm256_or_si256 (hits, _mm256_cmpeq_epi8 (
+                block, _mm256_set1_epi8 (delimiter)));
+      }
+      uint32_t mask = _mm256_movemask_epi8 (hits);
+      if (not wanted) mask = ~mask;
+      if (mask != 0) return pos + __builtin_ctz (mask);
+      pos += 32;
+   }
+#endif
+#ifdef __SSE2__
+   while (pos + 16 <= text.size()) {
+      __m128i block = _mm_loadu_si128 (
+            reinterpret_cast<const __m128i*> (text.data() + pos));
+      __m128i hits = _mm_setzero_si128();
+      for (char delimiter: delimiters) {
+         hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (
+                block, _mm_set1_epi8 (delimiter)));
+      }
+      uint32_t mask = _mm_movemask_epi8 (hits);
+      if (not wanted) mask = ~mask & 0xFFFF;
+      if (mask != 0) return pos + __builtin_ctz (mask);
+      pos += 16;
+   }
+#endif
+   for (; pos < text.size(); ++pos) {
+      bool is_delimiter = delimiters.find (text[pos])
+                       != string_view::npos;
+      if (is_delimiter == wanted) break;
+   }
+   return pos;
+}
+
+void split (string_view line, string_view delimiters,
+            wordviews& words) {
+   words.clear();
    size_t end = 0;
 
    // Loop over the string, splitting out words, and for each word
-   // thus found, append it to the output wordvec.
+   // thus found, append a view of it to the output.
    for (;;) {
-      size_t start = line.find_first_not_of (delimiters, end);
-      if (start == string::npos) break;
-      end = line.find_first_of (delimiters, start);
+      size_t start = find_delimiter (line, end, delimiters, false);
+      if (start == line.size()) break;
+      end = find_delimiter (line, start, delimiters, true);
       words.push_back (line.substr (start, end - start));
    }
    DEBUGF ('u', words);
-   return words;
+}
+
+wordvec split (const string& line, const string& delimiters) {
+   wordviews views;
+   split (line, delimiters, views);
+   return wordvec (views.cbegin(), views.cend());
+}
+
+mapped_file::mapped_file (const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) throw runtime_error (filename + ": " + strerror (errno));
+   struct stat status;
+   if (fstat (fd, &status) < 0) {
+      int error = errno;
+      close (fd);
+      throw runtime_error (filename + ": " + strerror (error));
+   }
+   size_ = status.st_size;
+   if (size_ > 0) {
+      data_ = mmap (nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data_ == MAP_FAILED) {
+         int error = errno;
+         close (fd);
+         data_ = nullptr;
+         throw runtime_error (filename + ": " + strerror (error));
+      }
+      madvise (data_, size_, MADV_SEQUENTIAL);
+   }
+   close (fd);
+   DEBUGF ('u', filename << ": " << size_ << " bytes");
+}
+
+mapped_file::~mapped_file() {
+   if (data_ != nullptr) munmap (data_, size_);
 }
 
 ostream& complain() {
    exec::status (EXIT_FAILURE);
+   cout.flush(); // Keep what was printed so far ahead of this.
    cerr << exec::execname() << ": ";
    return cerr;
 }
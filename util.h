@@ -10,6 +10,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 using namespace std;
 
@@ -20,6 +21,7 @@ using range_type = pair<iterator,iterator>;
 
 using wordvec = vector<string>;
 using word_range = range_type<decltype(declval<wordvec>().cbegin())>;
+using wordviews = vector<string_view>;
 
 // want_echo -
 //    We want to echo all of cin to cout if either cin or cout
@@ -56,6 +58,52 @@ class exec {
 
 wordvec split (const string& line, const string& delimiter);
 
+// split (views) -
+//    As above, but the words are string_views into the line, stored
+//    into a caller's vector which is cleared first, so that reusing
+//    the vector makes splitting allocation free.  The line must
+//    outlive the words.  Delimiters are scanned for 32 or 16 bytes
+//    at a time when built with AVX2 or SSE2, and a byte at a time
+//    otherwise.
+
+void split (string_view line, string_view delimiters,
+            wordviews& words);
+
+// tokenizer -
+//    Owns a reusable vector of words for splitting command lines.
+//    The words returned are views into the line passed in and are
+//    valid until the line changes or split is called again.
+
+class tokenizer {
+   private:
+      wordviews words_;
+   public:
+      const wordviews& split (string_view line,
+                              string_view delimiters) {
+         ::split (line, delimiters, words_);
+         return words_;
+      }
+};
+
+// mapped_file -
+//    A whole file mapped read-only into memory, and unmapped again
+//    by the destructor.  Throws runtime_error if the file can not
+//    be opened or mapped.
+
+class mapped_file {
+   private:
+      void* data_ {nullptr};
+      size_t size_ {0};
+   public:
+      explicit mapped_file (const string& filename);
+      ~mapped_file();
+      mapped_file (const mapped_file&) = delete;
+      mapped_file& operator= (const mapped_file&) = delete;
+      string_view text() const {
+         return {static_cast<const char*> (data_), size_};
+      }
+};
+
 // complain -
 //    Used for starting error messages.  Sets the exit status to
 //    EXIT_FAILURE, writes the program name to cerr, and then
@@ -0,0 +1,94 @@
+// $Id: work_pool.cpp,v 1.1 2026-10-17 15:02:10-07 - - $
+
+#include <thread>
+
+using namespace std;
+
+#include "work_pool.h"
+
+work_pool::work_pool (size_t workers) {
+   if (workers == 0) workers = 1;
+   for (size_t worker = 0; worker < workers; ++worker) {
+      queues_.push_back (make_unique<queue>());
+   }
+}
+
+void work_pool::run (task first) {
+   spawn (0, move (first));
+   vector<thread> threads;
+   for (size_t worker = 1; worker < queues_.size(); ++worker) {
+      threads.emplace_back (&work_pool::work, this, worker);
+   }
+   work (0);
+   for (thread& worker: threads) worker.join();
+}
+
+void work_pool::spawn (size_t self, task next) {
+   pending_.fetch_add (1, memory_order_relaxed);
+   queue& own = *queues_[self];
+   {
+      lock_guard<mutex> guard (own.lock);
+      own.tasks.push_back (move (next));
+   }
+   queued_.fetch_add (1, memory_order_release);
+   wake (false);
+}
+
+// wake -
+//    Wakes one sleeping worker, or all of them.  Taking idle_lock_
+//    first means none can have seen the old counts and not yet be
+//    waiting, which would miss the wakeup.
+
+void work_pool::wake (bool all) {
+   { lock_guard<mutex> guard (idle_lock_); }
+   if (all) wake_.notify_all();
+       else wake_.notify_one();
+}
+
+// take -
+//    Pops the newest task of this worker, or else steals the oldest
+//    task of the next worker round that has one.
+
+bool work_pool::take (size_t self, task& next) {
+   for (size_t offset = 0; offset < queues_.size(); ++offset) {
+      queue& victim = *queues_[(self + offset) % queues_.size()];
+      lock_guard<mutex> guard (victim.lock);
+      if (victim.tasks.empty()) continue;
+      if (offset == 0) {
+         next = move (victim.tasks.back());
+         victim.tasks.pop_back();
+      }else {
+         next = move (victim.tasks.front());
+         victim.tasks.pop_front();
+      }
+      return true;
+   }
+   return false;
+}
+
+// work -
+//    The loop of each worker.  A task is still pending while it
+//    runs, so no worker quits while one could spawn more.  The one
+//    that finishes the last task wakes the rest to quit.
+
+void work_pool::work (size_t self) {
+   task next;
+   for (;;) {
+      if (take (self, next)) {
+         queued_.fetch_sub (1, memory_order_relaxed);
+         next (self);
+         next = nullptr;
+         if (pending_.fetch_sub (1, memory_order_acq_rel) == 1) {
+            wake (true);
+         }
+         continue;
+      }
+      unique_lock<mutex> guard (idle_lock_);
+      wake_.wait (guard, [this] {
+         return queued_.load (memory_order_acquire) > 0
+             or pending_.load (memory_order_acquire) == 0;
+      });
+      if (pending_.load (memory_order_acquire) == 0) return;
+   }
+}
+
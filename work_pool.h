@@ -0,0 +1,59 @@
+// $Id: work_pool.h,v 1.1 2026-10-17 15:02:10-07 - - $
+
+// work_pool -
+//    A work-stealing pool of threads for splitting a traversal into
+//    tasks.  Each worker keeps its own deque of tasks, pushing and
+//    popping at the back, so it works depth first through what it
+//    spawned itself.  A worker whose deque is empty steals from the
+//    front of another's, where the oldest and so usually biggest
+//    tasks are.  A worker that finds no task anywhere sleeps until
+//    one is queued, or until none is pending and it can quit.
+
+#ifndef __WORK_POOL_H__
+#define __WORK_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+// work_pool ctor -
+//    Sets up queues for the given number of workers, at least one.
+//    No threads are started until run.
+// run -
+//    Runs first, and every task spawned from it, on the workers,
+//    the calling thread being worker 0.  Returns when all are done.
+// spawn -
+//    Called from within a task to queue another on the deque of the
+//    worker running it, whose number is passed to every task.
+
+class work_pool {
+   public:
+      using task = function<void (size_t self)>;
+      explicit work_pool (size_t workers);
+      work_pool (const work_pool&) = delete;
+      work_pool& operator= (const work_pool&) = delete;
+      size_t workers() const { return queues_.size(); }
+      void run (task first);
+      void spawn (size_t self, task next);
+   private:
+      struct queue {
+         mutex lock;
+         deque<task> tasks;
+      };
+      vector<unique_ptr<queue>> queues_;
+      atomic<size_t> pending_ {0};  // queued or running
+      atomic<size_t> queued_ {0};   // in some deque
+      mutex idle_lock_;
+      condition_variable wake_;
+      void wake (bool all);
+      bool take (size_t self, task& next);
+      void work (size_t self);
+};
+
+#endif
+
@@ -0,0 +1,408 @@
+// $Id: ygen.cpp,v 1.1 2026-10-17 19:05:12-07 - - $
+
+// ygen -
+//    Writes a synthetic yshell script to cout, for yreplay or
+//    yshell -f to run:  count commands drawn from a mix, building a
+//    tree of a given shape, with files of a given size distribution.
+//    The same options and seed always give the same script, on any
+//    machine, since every random number comes from mt19937_64,
+//    whose output the standard fixes, and never from a standard
+//    distribution, whose output it does not.
+//
+//    Every path is relative to the root, and the shell is kept
+//    there:  cd goes down to a directory and back up with a second
+//    cd, so it counts as two commands.  The generator keeps a model
+//    of the tree, so that ls, cat, rm, and rmr name files that
+//    exist, and make and mkdir names that do not, unless the model
+//    is empty, when they fall back to make or mkdir.
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#include "output.h"
+#include "util.h"
+
+// options -
+//    -s seed   seeds the generator; 1 by default.
+//    -n count  the number of commands; 1000000 by default.
+//    -m mix    the weight of each command, as a list of name=weight
+//              pairs separated by commas, of cat, cd, ls, lsr, make,
+//              mkdir, rm, and rmr.  Those not given weigh 0.
+//    -t shape  where new files go:  deep, a chain of directories
+//              each made in the last one, up to -D levels before
+//              starting again from the root; wide, everything in a
+//              few directories at the root; or zipf, the default,
+//              in directories picked with a zipf distribution over
+//              the order they were made in, so that a few early
+//              ones have most of the children.
+//    -D depth  the longest chain of a deep tree; 256 by default.
+//    -w sizes  the number of words in each file made:  fixed:N,
+//              uniform:MIN:MAX, or zipf:MAX; fixed:8 by default.
+
+enum class tree_shape {DEEP, WIDE, ZIPF};
+enum class size_dist {FIXED, UNIFORM, ZIPF};
+
+static const string_view OPERATIONS[] {
+   "cat", "cd", "ls", "lsr", "make", "mkdir", "rm", "rmr",
+};
+
+struct options {
+   uint64_t seed {1};
+   size_t count {1000000};
+   string mix {"cat=25,cd=3,ls=20,lsr=1,make=30,mkdir=10,rm=10,rmr=1"};
+   tree_shape shape {tree_shape::ZIPF};
+   size_t depth {256};
+   size_dist sizes {size_dist::FIXED};
+   size_t min_words {8};
+   size_t max_words {8};
+};
+
+// number -
+//    Parses an unsigned operand, or complains and exits.
+
+static uint64_t number (string_view arg, const char* what) {
+   uint64_t value = 0;
+   auto [end, error] = from_chars (arg.data(), arg.data() + arg.size(),
+                                   value);
+   if (error == errc() and end == arg.data() + arg.size()) {
+      return value;
+   }
+   complain() << what << " " << arg << ": invalid number" << endl;
+   exit (EXIT_FAILURE);
+}
+
+static void scan_sizes (options& opts, string_view arg) {
+   wordviews fields;
+   split (arg, ":", fields);
+   if (fields.size() == 2 and fields[0] == "fixed") {
+      opts.sizes = size_dist::FIXED;
+      opts.min_words = opts.max_words = number (fields[1], "-w");
+   }else if (fields.size() == 3 and fields[0] == "uniform") {
+      opts.sizes = size_dist::UNIFORM;
+      opts.min_words = number (fields[1], "-w");
+      opts.max_words = number (fields[2], "-w");
+   }else if (fields.size() == 2 and fields[0] == "zipf") {
+      opts.sizes = size_dist::ZIPF;
+      opts.min_words = 1;
+      opts.max_words = number (fields[1], "-w");
+   }else {
+      complain() << "-w " << arg << ": invalid sizes" << endl;
+      exit (EXIT_FAILURE);
+   }
+   if (opts.max_words < opts.min_words) {
+      complain() << "-w " << arg << ": invalid sizes" << endl;
+      exit (EXIT_FAILURE);
+   }
+}
+
+static options scan_options (int argc, char** argv) {
+   options result;
+   opterr = 0;
+   for (;;) {
+      int option = getopt (argc, argv, "D:m:n:s:t:w:");
+      if (option == EOF) break;
+      switch (option) {
+         case 'D':
+            result.depth = max<uint64_t> (number (optarg, "-D"), 1);
+            break;
+         case 'm':
+            result.mix = optarg;
+            break;
+         case 'n':
+            result.count = number (optarg, "-n");
+            break;
+         case 's':
+            result.seed = number (optarg, "-s");
+            break;
+         case 't':
+            if (optarg == string ("deep")) {
+               result.shape = tree_shape::DEEP;
+            }else if (optarg == string ("wide")) {
+               result.shape = tree_shape::WIDE;
+            }else if (optarg == string ("zipf")) {
+               result.shape = tree_shape::ZIPF;
+            }else {
+               complain() << "-t " << optarg << ": invalid shape"
+                          << endl;
+               exit (EXIT_FAILURE);
+            }
+            break;
+         case 'w':
+            scan_sizes (result, optarg);
+            break;
+         default:
+            complain() << "-" << static_cast<char> (optopt)
+                       << ": invalid option" << endl;
+            break;
+      }
+   }
+   if (optind < argc) {
+      complain() << "operands not permitted" << endl;
+   }
+   return result;
+}
+
+// workload -
+//    The model of the tree, and the random numbers that grow it.
+//    Directory 0 is the root, whose path is empty.  Removed files
+//    and directories stay in the vectors, marked dead, and the
+//    descendants of a directory removed by rmr are dead because
+//    one of their ancestors is.  Each directory counts the live
+//    files made directly in it, so that rmr can take those below it
+//    off live_files_.
+
+class workload {
+   private:
+      struct node {
+         string path;
+         size_t parent;
+         size_t depth;
+         bool dead;
+      };
+      mt19937_64 random_;
+      const options& opts_;
+      vector<node> dirs_ {{"", 0, 0, false}};
+      vector<node> files_;
+      vector<size_t> dir_files_ {0};
+      size_t live_files_ {0};
+      size_t chain_ {0};          // the end of a deep tree's chain
+      uint64_t weights_[size (OPERATIONS)] {};
+      uint64_t total_weight_ {0};
+      uint64_t below (uint64_t limit) { return random_() % limit; }
+      size_t zipf (size_t limit);
+      bool alive (size_t dir) const;
+      size_t pick_dir (bool allow_root);
+      size_t pick_file();
+      size_t pick_parent();
+      string child_path (size_t parent, char kind, size_t number);
+      void make (ostream& out);
+      void mkdir (ostream& out);
+      void rmr (ostream& out);
+   public:
+      explicit workload (const options& opts);
+      void command (ostream& out);
+};
+
+workload::workload (const options& opts):
+            random_ (opts.seed), opts_ (opts) {
+   wordviews pairs;
+   split (opts.mix, ",", pairs);
+   for (string_view pair: pairs) {
+      size_t equals = pair.find ('=');
+      string_view name = pair.substr (0, equals);
+      size_t index = 0;
+      while (index < size (OPERATIONS) and OPERATIONS[index] != name) {
+         ++index;
+      }
+      if (equals == string_view::npos or index == size (OPERATIONS)) {
+         complain() << "-m " << pair << ": invalid mix" << endl;
+         exit (EXIT_FAILURE);
+      }
+      weights_[index] = number (pair.substr (equals + 1), "-m");
+      total_weight_ += weights_[index];
+   }
+   if (total_weight_ == 0) {
+      complain() << "-m " << opts.mix << ": nothing to run" << endl;
+      exit (EXIT_FAILURE);
+   }
+}
+
+// zipf -
+//    A rank in [0, limit) with a probability falling off about as
+//    1/rank:  the exponential of a uniform draw over [0, log limit).
+
+size_t workload::zipf (size_t limit) {
+   double uniform = (random_() >> 11) * 0x1.0p-53;
+   size_t rank = exp (uniform * log (limit + 1.0)) - 1.0;
+   return rank < limit ? rank : limit - 1;
+}
+
+bool workload::alive (size_t dir) const {
+   for (; dir != 0; dir = dirs_[dir].parent) {
+      if (dirs_[dir].dead) return false;
+   }
+   return true;
+}
+
+// pick_dir, pick_file -
+//    A random live directory or file.  Dead ones are passed over by
+//    drawing again, and after a few misses, by scanning from where
+//    the last draw fell.  pick_file returns files_.size() if there
+//    are none, and pick_dir the root if it is not allowed and there
+//    is nothing else.
+
+size_t workload::pick_dir (bool allow_root) {
+   size_t first = allow_root ? 0 : 1;
+   if (dirs_.size() <= first) return 0;
+   size_t dir = 0;
+   for (size_t tries = 0; tries < 8; ++tries) {
+      dir = first + below (dirs_.size() - first);
+      if (alive (dir)) return dir;
+   }
+   for (size_t step = 0; step < dirs_.size() - first; ++step) {
+      size_t next = first + (dir - first + step)
+                  % (dirs_.size() - first);
+      if (alive (next)) return next;
+   }
+   return 0;
+}
+
+size_t workload::pick_file() {
+   if (live_files_ == 0) return files_.size();
+   size_t file = 0;
+   for (size_t tries = 0; tries < 8; ++tries) {
+      file = below (files_.size());
+      if (not files_[file].dead and alive (files_[file].parent)) {
+         return file;
+      }
+   }
+   for (size_t step = 0; step < files_.size(); ++step) {
+      size_t next = (file + step) % files_.size();
+      if (not files_[next].dead and alive (files_[next].parent)) {
+         return next;
+      }
+   }
+   return files_.size();
+}
+
+// pick_parent -
+//    Where the next new file or directory goes, by the shape.
+
+size_t workload::pick_parent() {
+   switch (opts_.shape) {
+      case tree_shape::DEEP:
+         if (not alive (chain_)) chain_ = 0;
+         return chain_;
+      case tree_shape::WIDE: {
+         size_t dir = min<size_t> (below (8), dirs_.size() - 1);
+         return alive (dir) and dirs_[dir].depth <= 1 ? dir : 0;
+      }
+      case tree_shape::ZIPF: {
+         size_t dir = zipf (dirs_.size());
+         return alive (dir) ? dir : 0;
+      }
+   }
+   return 0;
+}
+
+string workload::child_path (size_t parent, char kind,
+                             size_t number) {
+   const string& path = dirs_[parent].path;
+   string result;
+   result.reserve (path.size() + 12);
+   if (not path.empty()) result.append (path).append (1, '/');
+   return result.append (1, kind).append (to_string (number));
+}
+
+void workload::make (ostream& out) {
+   size_t parent = pick_parent();
+   files_.push_back ({child_path (parent, 'f', files_.size()), parent,
+                      dirs_[parent].depth + 1, false});
+   ++dir_files_[parent];
+   ++live_files_;
+   size_t words = opts_.min_words;
+   switch (opts_.sizes) {
+      case size_dist::FIXED:
+         break;
+      case size_dist::UNIFORM:
+         words += below (opts_.max_words - opts_.min_words + 1);
+         break;
+      case size_dist::ZIPF:
+         words += zipf (opts_.max_words);
+         break;
+   }
+   out << "make " << files_.back().path;
+   for (size_t word = 0; word < words; ++word) {
+      out << " w" << zipf (1000);
+   }
+   out << '\n';
+}
+
+void workload::mkdir (ostream& out) {
+   size_t parent = pick_parent();
+   if (opts_.shape == tree_shape::DEEP
+       and dirs_[parent].depth >= opts_.depth) parent = 0;
+   dirs_.push_back ({child_path (parent, 'd', dirs_.size()), parent,
+                     dirs_[parent].depth + 1, false});
+   dir_files_.push_back (0);
+   if (opts_.shape == tree_shape::DEEP) chain_ = dirs_.size() - 1;
+   out << "mkdir " << dirs_.back().path << '\n';
+}
+
+// rmr -
+//    Removes a live directory other than the root.  A directory is
+//    always made after its parent, so one pass up dirs_ from it finds
+//    every live directory below it, whose files are no longer live.
+//    Those below a directory already dead were counted off then.
+
+void workload::rmr (ostream& out) {
+   size_t dir = pick_dir (false);
+   if (dir == 0) { mkdir (out); return; }
+   out << "rmr " << dirs_[dir].path << '\n';
+   vector<bool> removed (dirs_.size() - dir);
+   removed[0] = true;
+   live_files_ -= dir_files_[dir];
+   for (size_t next = dir + 1; next < dirs_.size(); ++next) {
+      size_t parent = dirs_[next].parent;
+      if (parent < dir or dirs_[next].dead
+          or not removed[parent - dir]) continue;
+      removed[next - dir] = true;
+      live_files_ -= dir_files_[next];
+   }
+   dirs_[dir].dead = true;
+}
+
+void workload::command (ostream& out) {
+   uint64_t draw = below (total_weight_);
+   size_t operation = 0;
+   while (draw >= weights_[operation]) draw -= weights_[operation++];
+   string_view name = OPERATIONS[operation];
+   if (name == "mkdir") { mkdir (out); return; }
+   if (name == "make") { make (out); return; }
+   if (name == "cat" or name == "rm") {
+      size_t file = pick_file();
+      if (file == files_.size()) { make (out); return; }
+      out << name << ' ' << files_[file].path << '\n';
+      if (name == "rm") {
+         files_[file].dead = true;
+         --dir_files_[files_[file].parent];
+         --live_files_;
+      }
+      return;
+   }
+   if (name == "rmr") { rmr (out); return; }
+   if (name == "ls" and live_files_ > 0 and below (2) == 0) {
+      size_t file = pick_file();
+      if (file != files_.size()) {
+         out << "ls " << files_[file].path << '\n';
+         return;
+      }
+   }
+   size_t dir = pick_dir (true);
+   const string& path = dir == 0 ? "/" : dirs_[dir].path;
+   if (name == "cd") out << "cd " << path << "\ncd\n";
+   else out << name << ' ' << path << '\n';
+}
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   options opts = scan_options (argc, argv);
+   output_sink sink (STDOUT_FILENO);
+   streambuf* stdout_buf = cout.rdbuf (&sink);
+   workload load (opts);
+   for (size_t command = 0; command < opts.count; ++command) {
+      load.command (cout);
+   }
+   cout.flush();
+   cout.rdbuf (stdout_buf);
+   return exec::status();
+}
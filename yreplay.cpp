@@ -0,0 +1,183 @@
+// $Id: yreplay.cpp,v 1.1 2026-10-17 19:05:12-07 - - $
+
+// yreplay -
+//    Runs a yshell script, as from ygen, through run_command, the
+//    way yshell -f does, timing every line.  What the commands print
+//    is thrown away, into /dev/null, unless -o is given.  At the end
+//    prints one line of JSON to cout for each command name, and one
+//    named "all" for every line, in the format of ybench:
+//       {"name":"make","ops":300210,"ns_per_op":2210.4,
+//        "ops_per_s":452406,"p50_ns":2047,"p99_ns":8191,
+//        "p999_ns":32767}
+//    Lines are grouped by the command they run, so that "#" and
+//    the names of no command are grouped too.  Blank lines are not
+//    counted.  Latencies are counted in the power-of-two histogram
+//    the stats command uses, so that memory does not grow with the
+//    script, and each percentile is the top of its bucket, within a
+//    factor of two.
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "file_sys.h"
+#include "metrics.h"
+#include "output.h"
+#include "util.h"
+
+// options -
+//    -@flags  sets debug flags.
+//    -i image starts from the tree saved in image.
+//    -o       lets the commands print to stdout, before the report.
+//    -T file  writes the trace of the debug flags set to file,
+//             instead of to yreplay.trace.
+//    script   the script to run, the only operand.
+
+struct options {
+   string image;
+   string script;
+   string trace;
+   bool output {false};
+};
+
+static options scan_options (int argc, char** argv) {
+   options result;
+   opterr = 0;
+   for (;;) {
+      int option = getopt (argc, argv, "@:i:oT:");
+      if (option == EOF) break;
+      switch (option) {
+         case '@':
+            debugflags::setflags (optarg);
+            break;
+         case 'i':
+            result.image = optarg;
+            break;
+         case 'o':
+            result.output = true;
+            break;
+         case 'T':
+            result.trace = optarg;
+            break;
+         default:
+            complain() << "-" << static_cast<char> (optopt)
+                       << ": invalid option" << endl;
+            break;
+      }
+   }
+   if (optind + 1 != argc) {
+      complain() << "usage: " << exec::execname()
+                 << " [-@flags] [-i image] [-o] [-T trace] script"
+                 << endl;
+      exit (EXIT_FAILURE);
+   }
+   result.script = argv[optind];
+   if (result.trace.empty() and debugflags::any()) {
+      result.trace = exec::execname() + ".trace";
+   }
+   return result;
+}
+
+// latencies -
+//    The times the lines of one command took:  their total, for the
+//    mean, and their histogram, for the percentiles.
+
+struct latencies {
+   uint64_t total {0};
+   latency_histogram histogram;
+   void add (uint64_t nanos) {
+      total += nanos;
+      histogram.add (nanos);
+   }
+};
+
+static void report (string_view name, const latencies& times) {
+   uint64_t ops = times.histogram.count();
+   if (ops == 0) return;
+   double nanos = times.total;
+   cout << "{\"name\":\"" << name << "\",\"ops\":" << ops
+        << ",\"ns_per_op\":" << nanos / ops
+        << ",\"ops_per_s\":" << ops * 1e9 / nanos
+        << ",\"p50_ns\":" << times.histogram.percentile (0.50)
+        << ",\"p99_ns\":" << times.histogram.percentile (0.99)
+        << ",\"p999_ns\":" << times.histogram.percentile (0.999)
+        << "}\n";
+}
+
+// replay -
+//    Runs the script, keeping the latencies of each command, by its
+//    registry entry, or nullptr for lines that name none.  Stops
+//    early if the script exits.
+
+static void replay (inode_state& state, const string& script,
+                    map<const command*,latencies>& times,
+                    latencies& all) {
+   mapped_file file (script);
+   string_view text = file.text();
+   tokenizer tokens;
+   while (not text.empty()) {
+      size_t newline = text.find ('\n');
+      string_view line = text.substr (0, newline);
+      text.remove_prefix (newline == string_view::npos
+                          ? text.size() : newline + 1);
+      const wordviews& words = tokens.split (line, " \t\r");
+      if (words.empty()) continue;
+      const command* cmd = find_command (words[0]);
+      auto start = chrono::steady_clock::now();
+      run_command (state, words);
+      auto stop = chrono::steady_clock::now();
+      uint64_t nanos = chrono::duration_cast<chrono::nanoseconds> (
+                       stop - start).count();
+      times[cmd].add (nanos);
+      all.add (nanos);
+   }
+}
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   options opts = scan_options (argc, argv);
+   int out_fd = opts.output ? STDOUT_FILENO
+                            : open ("/dev/null", O_WRONLY);
+   if (out_fd < 0) {
+      complain() << "/dev/null: cannot open" << endl;
+      return EXIT_FAILURE;
+   }
+   map<const command*,latencies> times;
+   latencies all;
+   auto start = chrono::steady_clock::now();
+   {
+      output_sink sink (out_fd);
+      streambuf* stdout_buf = cout.rdbuf (&sink);
+      inode_state state;
+      try {
+         if (not opts.trace.empty()) trace::start (opts.trace);
+         if (not opts.image.empty()) state.load_image (opts.image);
+         replay (state, opts.script, times, all);
+      }catch (ysh_exit&) {
+      }catch (runtime_error& error) {
+         complain() << error.what() << endl;
+      }
+      cout.flush();
+      cout.rdbuf (stdout_buf);
+   }
+   chrono::duration<double> elapsed = chrono::steady_clock::now()
+                                    - start;
+   if (out_fd != STDOUT_FILENO) close (out_fd);
+   for (const auto& [cmd, lines]: times) {
+      report (cmd == nullptr ? "unknown" : cmd->name, lines);
+   }
+   report ("all", all);
+   uint64_t lines = all.histogram.count();
+   cerr << exec::execname() << ": " << lines << " lines in "
+        << elapsed.count() << " s, " << lines / elapsed.count()
+        << " lines/s" << endl;
+   return exec::status();
+}
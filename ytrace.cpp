@@ -0,0 +1,212 @@
+// $Id: ytrace.cpp,v 1.1 2026-10-17 20:31:48-07 - - $
+
+// ytrace -
+//    Decodes a trace file written by yshell or yreplay with debug
+//    flags set, and prints its events to cout in the order they
+//    were made, across all threads, one to a line:
+//       0.000012345 t0 DEBUG(i) file_sys.cpp[120] ...: payload
+//    the seconds since the first event, the thread, the flag, the
+//    file and line of the DEBUGF, its function, and its payload,
+//    which was cut at 44 bytes.  A trace cut short, as by a crash,
+//    is decoded up to its last whole chunk.  If a thread lost events
+//    because its ring was full, how many is reported on cerr after
+//    the events.
+
+#include <algorithm>
+#include <bitset>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#include "debug.h"
+#include "output.h"
+#include "util.h"
+
+// options -
+//    -f flags  prints only the events of these flags; all of them
+//              by default.
+//    trace     the trace file, the only operand.
+
+struct options {
+   bitset<UCHAR_MAX + 1> flags;
+   string trace;
+};
+
+static options scan_options (int argc, char** argv) {
+   options result;
+   opterr = 0;
+   for (;;) {
+      int option = getopt (argc, argv, "f:");
+      if (option == EOF) break;
+      switch (option) {
+         case 'f':
+            for (unsigned char flag: string_view (optarg)) {
+               result.flags.set (flag);
+            }
+            break;
+         default:
+            complain() << "-" << static_cast<char> (optopt)
+                       << ": invalid option" << endl;
+            break;
+      }
+   }
+   if (optind + 1 != argc) {
+      complain() << "usage: " << exec::execname()
+                 << " [-f flags] trace" << endl;
+      exit (EXIT_FAILURE);
+   }
+   if (result.flags.none()) result.flags.set();
+   result.trace = argv[optind];
+   return result;
+}
+
+// site -
+//    A DEBUGF, as its SITE chunk describes it.
+
+struct site {
+   char flag {'?'};
+   uint32_t line {0};
+   string_view file {"?"};
+   string_view function {"?"};
+};
+
+// decoded -
+//    The sites and events of a trace.  The names of sites view the
+//    mapped file.  Events are copied out, since the strings of sites
+//    before them leave them unaligned.  dropped counts the events
+//    lost by each thread.
+
+struct decoded {
+   vector<site> sites;
+   vector<trace_event> events;
+   map<uint32_t,uint64_t> dropped;
+};
+
+// take -
+//    Copies the next object out of the text, and consumes it, or
+//    returns false if the text is too short.
+
+template <typename object_t>
+static bool take (string_view& text, object_t& object) {
+   if (text.size() < sizeof object) return false;
+   memcpy (&object, text.data(), sizeof object);
+   text.remove_prefix (sizeof object);
+   return true;
+}
+
+static void decode_site (string_view bytes, decoded& trace) {
+   trace_site_record record;
+   if (not take (bytes, record)
+       or bytes.size() < size_t (record.file_length)
+                         + record.function_length) return;
+   if (trace.sites.size() <= record.site) {
+      trace.sites.resize (record.site + 1);
+   }
+   site& into = trace.sites[record.site];
+   into.flag = record.flag;
+   into.line = record.line;
+   into.file = bytes.substr (0, record.file_length);
+   into.function = bytes.substr (record.file_length,
+                                 record.function_length);
+}
+
+static void decode_events (string_view bytes, decoded& trace,
+                           const options& opts) {
+   trace_event event;
+   while (take (bytes, event)) {
+      if (not opts.flags.test (static_cast<unsigned char> (
+                                  event.flag))) continue;
+      trace.events.push_back (event);
+   }
+}
+
+// decode -
+//    Reads every chunk of the trace, or complains of the first that
+//    is not whole, and stops there.
+
+static void decode (string_view text, const string& filename,
+                    decoded& trace, const options& opts) {
+   trace_header header;
+   if (not take (text, header)
+       or memcmp (header.magic, trace_header::MAGIC,
+                  sizeof header.magic) != 0) {
+      complain() << filename << ": not a trace" << endl;
+      return;
+   }
+   while (not text.empty()) {
+      trace_chunk chunk;
+      if (not take (text, chunk) or text.size() < chunk.bytes) {
+         complain() << filename << ": truncated" << endl;
+         return;
+      }
+      string_view bytes = text.substr (0, chunk.bytes);
+      text.remove_prefix (chunk.bytes);
+      switch (chunk.kind) {
+         case trace_chunk::SITE:
+            decode_site (bytes, trace);
+            break;
+         case trace_chunk::EVENTS:
+            decode_events (bytes, trace, opts);
+            break;
+         case trace_chunk::DROPPED: {
+            trace_dropped_record record;
+            if (take (bytes, record)) {
+               trace.dropped[record.thread] += record.events;
+            }
+            break;
+         }
+      }
+   }
+}
+
+static void print_event (ostream& out, const trace_event& event,
+                         const site& where, uint64_t first) {
+   char seconds[32];
+   snprintf (seconds, sizeof seconds, "%.9f",
+             (event.nanos - first) / 1e9);
+   size_t length = min<size_t> (event.length, trace_event::PAYLOAD);
+   out << seconds << " t" << event.thread << " DEBUG(" << event.flag
+       << ") " << where.file << "[" << where.line << "] "
+       << where.function << ": "
+       << string_view (event.payload, length) << "\n";
+}
+
+int main (int argc, char** argv) {
+   exec::execname (argv[0]);
+   options opts = scan_options (argc, argv);
+   output_sink sink (STDOUT_FILENO);
+   streambuf* stdout_buf = cout.rdbuf (&sink);
+   try {
+      mapped_file file (opts.trace);
+      decoded trace;
+      decode (file.text(), opts.trace, trace, opts);
+      stable_sort (trace.events.begin(), trace.events.end(),
+                   [] (const trace_event& one, const trace_event& two) {
+                      return one.nanos < two.nanos;
+                   });
+      site unknown;
+      for (const trace_event& event: trace.events) {
+         const site& where = event.site < trace.sites.size()
+                           ? trace.sites[event.site] : unknown;
+         print_event (cout, event, where, trace.events[0].nanos);
+      }
+      cout.flush();
+      for (const auto& [thread, events]: trace.dropped) {
+         cerr << exec::execname() << ": " << opts.trace << ": t"
+              << thread << " dropped " << events << " events" << endl;
+      }
+   }catch (runtime_error& error) {
+      complain() << error.what() << endl;
+   }
+   cout.flush();
+   cout.rdbuf (stdout_buf);
+   return exec::status();
+}